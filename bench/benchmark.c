@@ -0,0 +1,415 @@
+/**
+ * @file benchmark.c
+ * @brief Benchmark harness for the hot paths of the Latin square game.
+ *
+ * Builds a corpus of puzzles for every order from 4 up to N and times
+ * reading, validating, checking, displaying, rendering, saving and solving
+ * them with every solver backend. Every case is warmed up first and then sampled repeatedly; the
+ * median and 99th percentile cost per call are reported in nanoseconds.
+ *
+ * Orders above 9 need a wider board: gcc -O2 -DN=31 bench/benchmark.c
+ *
+ * @author Nicolas Constantinou
+ * @date 27/09/2024
+ */
+#define LATINSQUARE_NO_MAIN
+#include "../src/latinsquare.c"
+
+#define BENCH_REPS 200 // Default samples per case
+#define BENCH_WARMUP 20 // Default untimed samples per case
+#define BENCH_SAMPLE_NS 20000 // Minimum length of one sample, calls are batched up to it
+#define BENCH_EMPTY 0.3 // Share of cells emptied in puzzles built beyond order 9
+#define BENCH_LOCAL_NODES 1000000 // Node cap of the local search, which cannot prove there is no completion
+#define BENCH_SEED 1 // Seed of the randomized backends, fixed so samples repeat
+
+typedef struct {
+    int size;           // Order of the puzzle
+    char file[32];      // Puzzle file in the scratch directory
+    int puzzle[N][N];   // Partially filled puzzle
+    int solution[N][N]; // Its completed square
+    int move[3];        // A valid move on the puzzle: 1-based row, column, value
+} BenchCase;
+
+typedef struct {
+    char *name;                  // Function being measured
+    void (*run)(BenchCase *bc);  // One call of it
+    int quiet;                   // Whether stdout is silenced while it runs
+} BenchOp;
+
+/**
+ * @brief Builds the benchmark puzzle of one order.
+ *
+ * Orders up to 9 use generateLatinSquare(); larger orders take a shuffled
+ * cyclic square and empty a fixed share of its cells, which keeps the
+ * corpus cheap to build. The puzzle is also written to the scratch directory.
+ *
+ * @param bc The case to fill.
+ * @param size The order of the puzzle.
+ * @param seed The seed of the puzzle.
+ * @return 1 if the case was built, 0 otherwise.
+ */
+int buildCase(BenchCase *bc, int size, uint64_t seed);
+
+/**
+ * @brief Times one operation on one case.
+ *
+ * Calibrates how many calls fit in one sample, runs the warmup samples and
+ * then the timed ones.
+ *
+ * @param op The operation to time.
+ * @param bc The case it runs on.
+ * @param reps The number of timed samples.
+ * @param warmup The number of untimed samples.
+ * @param median Where the median cost per call is stored, in nanoseconds.
+ * @param p99 Where the 99th percentile cost per call is stored, in nanoseconds.
+ * @return void
+ */
+void timeOp(BenchOp *op, BenchCase *bc, int reps, int warmup, double *median, double *p99);
+
+/**
+ * @brief Returns a monotonic timestamp in nanoseconds.
+ *
+ * @return The timestamp.
+ */
+long long monotonicNs();
+
+/**
+ * @brief Orders two samples for qsort().
+ *
+ * @param a The first sample.
+ * @param b The second sample.
+ * @return Negative, zero or positive as a is below, equal to or above b.
+ */
+int compareSamples(const void *a, const void *b);
+
+/**
+ * @brief Completes a case with one solver backend.
+ *
+ * Loads the puzzle into a fresh solver and runs the backend until its first
+ * completion, as the portfolio does.
+ *
+ * @param bc The case.
+ * @param run The search of the backend.
+ * @return void
+ */
+void benchBackend(BenchCase *bc, void (*run)(Solver *solver));
+
+void benchRead(BenchCase *bc);
+void benchValidMove(BenchCase *bc);
+void benchCheckGame(BenchCase *bc);
+void benchDisplay(BenchCase *bc);
+void benchRender(BenchCase *bc);
+void benchWrite(BenchCase *bc);
+void benchSolve(BenchCase *bc);
+void benchUnique(BenchCase *bc);
+void benchPropagate(BenchCase *bc);
+void benchPropagating(BenchCase *bc);
+void benchLinks(BenchCase *bc);
+void benchLocal(BenchCase *bc);
+void benchRestarts(BenchCase *bc);
+
+volatile long benchSink; // Keeps results alive so calls are not optimized away
+
+/**
+ * @brief Runs the benchmark.
+ *
+ * Usage: benchmark [--reps <n>] [--warmup <n>] [--max-order <n>]
+ *
+ * @param argc The number of command-line arguments.
+ * @param argv The command-line arguments.
+ * @return 0 on success, 1 otherwise.
+ */
+int main(int argc, char *argv[]){
+
+    int reps = BENCH_REPS, warmup = BENCH_WARMUP, maxOrder = N;
+    for(int k = 1; k < argc; k++){
+        if(strcmp(argv[k], "--reps") == 0 && k + 1 < argc){
+            reps = atoi(argv[++k]);
+        }
+        else if(strcmp(argv[k], "--warmup") == 0 && k + 1 < argc){
+            warmup = atoi(argv[++k]);
+        }
+        else if(strcmp(argv[k], "--max-order") == 0 && k + 1 < argc){
+            maxOrder = atoi(argv[++k]);
+        }
+        else{
+            fprintf(stderr, "usage: %s [--reps <n>] [--warmup <n>] [--max-order <n>]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(reps < 1 || warmup < 0 || maxOrder < 4 || maxOrder > N){
+        fprintf(stderr, "reps must be positive and the order between 4 and %d\n", N);
+        return 1;
+    }
+
+    char dir[] = "/tmp/latinsquare-bench-XXXXXX";
+    if(mkdtemp(dir) == NULL || chdir(dir) != 0){
+        perror("scratch directory");
+        return 1;
+    }
+
+    BenchOp ops[] = {
+        {"readLatinSquare", benchRead, 0},
+        {"validMove", benchValidMove, 0},
+        {"checkGame", benchCheckGame, 0},
+        {"displayLatinSquare", benchDisplay, 1},
+        {"renderLatinSquare", benchRender, 0},
+        {"writeLatinSquare", benchWrite, 1},
+        {"solveLatinSquare/1", benchSolve, 0},
+        {"solveLatinSquare/2", benchUnique, 0},
+        {"propagateSolver", benchPropagate, 0},
+        {"searchPropagating", benchPropagating, 0},
+        {"solveLinks", benchLinks, 0},
+        {"searchLocal", benchLocal, 0},
+        {"searchRestarts", benchRestarts, 0},
+    };
+    int nops = sizeof(ops) / sizeof(ops[0]);
+
+    int console = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    FILE *report = fdopen(console, "w");
+    if(console < 0 || devnull < 0 || report == NULL){
+        perror("stdout");
+        return 1;
+    }
+
+    fprintf(report, "%-20s %5s %14s %14s\n", "function", "order", "median ns", "p99 ns");
+    for(int size = 4; size <= maxOrder; size++){
+        BenchCase bc;
+        if(!buildCase(&bc, size, 0x6c61746eull + size)){
+            fprintf(stderr, "cannot build the order %d case\n", size);
+            return 1;
+        }
+        for(int k = 0; k < nops; k++){
+            double median, p99;
+            if(ops[k].quiet){
+                fflush(stdout);
+                dup2(devnull, STDOUT_FILENO);
+            }
+            timeOp(&ops[k], &bc, reps, warmup, &median, &p99);
+            if(ops[k].quiet){
+                fflush(stdout);
+                dup2(console, STDOUT_FILENO);
+            }
+            fprintf(report, "%-20s %5d %14.0f %14.0f\n", ops[k].name, size, median, p99);
+            fflush(report);
+        }
+        unlink(bc.file);
+        char out[40] = "-out";
+        unlink(strcat(out, bc.file));
+    }
+
+    close(devnull);
+    chdir("/");
+    rmdir(dir);
+    return 0;
+
+}
+
+int buildCase(BenchCase *bc, int size, uint64_t seed){
+
+    memset(bc, 0, sizeof(BenchCase));
+    bc->size = size;
+    sprintf(bc->file, "order%d.txt", size);
+
+    if(size <= 9){
+        generateLatinSquare(bc->puzzle, size, seed, NULL);
+    }
+    else{
+        int shift[N];
+        for(int k = 0; k < size; k++){
+            shift[k] = k;
+        }
+        for(int k = size - 1; k > 0; k--){
+            int r = randomNext(&seed) % (k + 1);
+            int t = shift[k]; shift[k] = shift[r]; shift[r] = t;
+        }
+        for(int i = 0; i < size; i++){
+            for(int j = 0; j < size; j++){
+                bc->puzzle[i][j] = -((shift[i] + j) % size + 1);
+                if(randomNext(&seed) % 1000 < BENCH_EMPTY * 1000){
+                    bc->puzzle[i][j] = 0;
+                }
+            }
+        }
+    }
+    if(solveLatinSquare(bc->puzzle, size, bc->solution, 1, NULL, NULL) != 1){
+        return 0;
+    }
+
+    for(int i = 0; i < size && bc->move[0] == 0; i++){
+        for(int j = 0; j < size; j++){
+            if(bc->puzzle[i][j] == 0){
+                bc->move[0] = i + 1;
+                bc->move[1] = j + 1;
+                bc->move[2] = bc->solution[i][j];
+                break;
+            }
+        }
+    }
+    if(bc->move[0] == 0){
+        return 0;
+    }
+
+    FILE *fp = fopen(bc->file, "w");
+    if(fp == NULL){
+        return 0;
+    }
+    fprintf(fp, "%d", size);
+    for(int i = 0; i < size; i++){
+        for(int j = 0; j < size; j++){
+            fprintf(fp, j == 0 ? "\n%d" : " %d", bc->puzzle[i][j]);
+        }
+    }
+    fclose(fp);
+
+    return 1;
+
+}
+
+void timeOp(BenchOp *op, BenchCase *bc, int reps, int warmup, double *median, double *p99){
+
+    long batch = 1;
+    for(;;){
+        long long start = monotonicNs();
+        for(long k = 0; k < batch; k++){
+            op->run(bc);
+        }
+        if(monotonicNs() - start >= BENCH_SAMPLE_NS || batch >= (1L << 20)){
+            break;
+        }
+        batch *= 2;
+    }
+
+    for(int r = 0; r < warmup; r++){
+        for(long k = 0; k < batch; k++){
+            op->run(bc);
+        }
+    }
+
+    double *samples = malloc(reps * sizeof(double));
+    for(int r = 0; r < reps; r++){
+        long long start = monotonicNs();
+        for(long k = 0; k < batch; k++){
+            op->run(bc);
+        }
+        samples[r] = (double)(monotonicNs() - start) / batch;
+    }
+    qsort(samples, reps, sizeof(double), compareSamples);
+    *median = samples[reps / 2];
+    *p99 = samples[(reps * 99) / 100 < reps ? (reps * 99) / 100 : reps - 1];
+    free(samples);
+
+}
+
+long long monotonicNs(){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
+}
+
+int compareSamples(const void *a, const void *b){
+
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+
+}
+
+void benchRead(BenchCase *bc){
+
+    int sudoku[N][N], size;
+    readLatinSquare(bc->file, sudoku, &size);
+    benchSink += size;
+
+}
+
+void benchValidMove(BenchCase *bc){
+
+    benchSink += validMove(bc->puzzle, bc->size, bc->move[2], bc->move[0], bc->move[1]);
+
+}
+
+void benchCheckGame(BenchCase *bc){
+
+    benchSink += checkGame(bc->solution, bc->size);
+
+}
+
+void benchDisplay(BenchCase *bc){
+
+    displayLatinSquare(bc->puzzle, bc->size);
+
+}
+
+void benchRender(BenchCase *bc){
+
+    char buf[RENDER_BYTES(N)];
+    benchSink += renderLatinSquare(bc->puzzle, bc->size, buf);
+
+}
+
+void benchWrite(BenchCase *bc){
+
+    writeLatinSquare(bc->puzzle, bc->size, bc->file);
+
+}
+
+void benchSolve(BenchCase *bc){
+
+    int solution[N][N];
+    benchSink += solveLatinSquare(bc->puzzle, bc->size, solution, 1, NULL, NULL);
+
+}
+
+void benchUnique(BenchCase *bc){
+
+    int solution[N][N];
+    benchSink += solveLatinSquare(bc->puzzle, bc->size, solution, 2, NULL, NULL);
+
+}
+
+void benchPropagate(BenchCase *bc){
+
+    Solver solver;
+    initSolver(&solver, bc->puzzle, bc->size);
+    benchSink += propagateSolver(&solver, 0);
+
+}
+
+void benchBackend(BenchCase *bc, void (*run)(Solver *solver)){
+
+    Solver solver;
+    initSolver(&solver, bc->puzzle, bc->size);
+    solver.limit = 1;
+    solver.seed = BENCH_SEED;
+    solver.nodeLimit = run == searchLocal ? BENCH_LOCAL_NODES : 0;
+    run(&solver);
+    benchSink += solver.solutions;
+
+}
+
+void benchPropagating(BenchCase *bc){
+
+    benchBackend(bc, searchPropagating);
+
+}
+
+void benchLinks(BenchCase *bc){
+
+    benchBackend(bc, solveLinks);
+
+}
+
+void benchLocal(BenchCase *bc){
+
+    benchBackend(bc, searchLocal);
+
+}
+
+void benchRestarts(BenchCase *bc){
+
+    benchBackend(bc, searchRestarts);
+
+}
@@ -8,11 +8,607 @@
  * @author Nicolas Constantinou
  * @date 27/09/2024
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#include <arpa/inet.h>
+#ifndef N
 #define N 9 // Max size of the Latin square
+#endif
+#if N > 31
+#error "N must fit the 32-bit candidate masks"
+#endif
+#define LOG_SYNC_BATCH 32 // Moves appended to the move log between two fsync calls
+#define LOG_HEADER_BYTES 8 // Magic, order and base board hash
+#define LOG_MOVE_BYTES 4 // Row, column, value and check byte
+#define LINE_LEN 256 // Longest command line read at once
+#define BATCH_MAX (LINE_LEN / 6) // Most moves one command line can carry
+#define SCRIPT_BUFFER (1 << 16) // Size of the stdin buffer in script mode
+#define DEADEND_BUDGET 0.002 // Seconds the dead-end check may spend after a move
+#define RENDER_BYTES(n) ((2*(n)+1)*(6*(n)+2)+1) // Bytes of a rendered square
+#define SERVER_BACKLOG 1024 // Pending connections queued by the server
+#define SERVER_EVENTS 256 // Events handled per epoll_wait call
+#define SLAB_BYTES (1 << 16) // Bytes allocated at once for a slab class
+#define SPECTATOR_QUEUE 64 // Broadcasts queued for a spectator before it is dropped
+#define DELTA_BYTES (2 * LINE_LEN) // Largest broadcast message
+#define LATENCY_BYTES ((COMMAND_TYPES + 2) * 80) // Largest latency table printed by the latency command
+#define SESSION_REPLY_BYTES(n) (2 * RENDER_BYTES(n) + LATENCY_BYTES + LINE_LEN) // Largest reply to one command line
+#define SESSION_OUT_BYTES(n) (2 * SESSION_REPLY_BYTES(n)) // Output buffer of a server session of order n
+#define HTTP_WORKERS 4 // Worker threads of the HTTP API
+#define HTTP_QUEUE 256 // Accepted connections waiting for a worker
+#define HTTP_BUFFER 8192 // Largest HTTP request and response
+#define HTTP_IDLE_SECONDS 5 // Idle time after which a keep-alive connection is closed
+#define METRICS_BUFFER (1<<15) // Bytes of a metrics scrape response
+#define TRACE_EVENTS (1<<14) // Spans kept per thread, older ones are overwritten
+#define LATENCY_SUB_BITS 4 // Histogram buckets per power of two are 1<<LATENCY_SUB_BITS, about 6% precision
+#define LATENCY_BUCKETS ((64-LATENCY_SUB_BITS+1)<<LATENCY_SUB_BITS) // Buckets covering any nanosecond latency
+#define COUNT_LIMIT 1000000 // Default cap of the completions counted by the API
+#define ESTIMATE_PROBES 2000 // Random root-to-leaf probes of the tree size estimate
+#define ESTIMATE_SEED 0x4b6e757468ull // Seed of the estimate probes, fixed so estimates are repeatable
+#define PROGRESS_SECONDS 1.0 // Time between two progress lines of --count
+#define HINT_SECONDS 0.04 // Solver budget of a hint, inside the 50 ms a hint must answer in
+#define HINT_SERVER_SECONDS 0.002 // Solver budget of a hint on the server's event loop, which every session waits on
+#define CHECK_INTERVAL 1024 // Search nodes between two checks for cancellation or timeout
+#define MAX_THREADS 64 // Most worker threads of a parallel search
+#define TASKS_PER_THREAD 8 // Subtrees queued per worker of a parallel search, so uneven subtrees even out
+#define HANGUP_SECONDS 0.01 // Time between two checks for a client hang-up during an HTTP solve
+#define LOCAL_NOISE 10 // Percent of local search steps taking a random swap, to leave local minima
+#define LOCAL_SEED 0x6c6f63616cull // Seed of the local search, fixed so runs repeat
+#define RESTART_UNIT 64 // Backtracks of the shortest run of the Luby restart schedule
+#define RESTART_SEED 0x6c756279ull // Default seed of the randomized restarts, --seed changes it
+#define LOG_SNAPSHOT_INTERVAL 256 // Moves between two full board snapshots in the move log
+#define LOG_SNAPSHOT_BYTES(n) (4 + (n)*(n)) // Marker, order, checksum and one byte per cell
+
+/**
+ * @brief Result codes of a move check.
+ */
+enum MoveError {
+    MOVE_OK = 0,
+    MOVE_RANGE,
+    MOVE_OCCUPIED,
+    MOVE_ILLEGAL_CLEAR,
+    MOVE_ILLEGAL_VALUE
+};
+
+/**
+ * @brief Append-only log of the accepted moves of a game.
+ *
+ * Every accepted move is written to "<file>.log" as soon as it is made, so a
+ * crash loses at most the moves that were not yet fsync'ed to disk. After
+ * every LOG_SNAPSHOT_INTERVAL moves a full board snapshot is written, so the
+ * offset of any move or snapshot follows from its index alone.
+ */
+typedef struct {
+    int fd;        // Log file descriptor, -1 when logging is disabled
+    int pending;   // Moves written since the last fsync
+    long moves;    // Moves stored in the log
+} MoveLog;
+
+/**
+ * @brief States of the background solve of a game.
+ */
+enum SolveState {
+    SOLVE_RUNNING = 0,
+    SOLVE_DONE
+};
+
+/**
+ * @brief Outcomes of a propagation pass.
+ */
+enum Propagation {
+    PROPAGATE_DEAD = -1,   // The square has no completion
+    PROPAGATE_STUCK = 0,   // No more cells are forced
+    PROPAGATE_SOLVED = 1,  // Every cell is filled
+    PROPAGATE_TIMEOUT = 2  // The time budget ran out
+};
+
+/**
+ * @brief Reasons a search stopped before exploring its whole tree.
+ */
+enum StopReason {
+    STOP_NONE = 0,
+    STOP_CANCELLED,
+    STOP_TIMEOUT,
+    STOP_NODES,
+    STOP_FOUND,        // Another worker found the solutions asked for, or finished first
+    STOP_DISCONNECTED, // The client of the request went away
+    STOP_RESTART       // A randomized run reached its cutoff, only seen by searchRestarts()
+};
+
+/**
+ * @brief Kinds of answers of hintCell().
+ */
+enum HintKind {
+    HINT_NONE = 0,  // No cell found
+    HINT_FORCED,    // The value is forced by the candidates
+    HINT_SOLVED,    // The value belongs to a completion
+    HINT_GUESS,     // The value belongs to the deepest partial completion of a stopped search
+    HINT_DEAD       // The square has no completion
+};
+
+/**
+ * @brief Formats of the --stats summary.
+ */
+enum StatsFormat {
+    STATS_OFF = 0,
+    STATS_TABLE,
+    STATS_JSON
+};
+
+/**
+ * @brief Hardware counters read by --perf.
+ */
+enum PerfCounter {
+    PERF_CYCLES = 0,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_COUNTERS
+};
+
+/**
+ * @brief Phases measured by --perf.
+ */
+enum PerfPhase {
+    PERF_SOLVE = 0,  // Backtracking searches, per search node
+    PERF_VERIFY,     // Propagation checks, per propagation pass
+    PERF_PHASES
+};
+
+/**
+ * @brief Command types with a latency histogram.
+ */
+enum CommandType {
+    COMMAND_INSERT = 0,  // Moves inserting at least one value
+    COMMAND_CLEAR,       // Moves clearing cells only
+    COMMAND_HINT,        // hint
+    COMMAND_QUERY,       // ? i,j
+    COMMAND_SAVE,        // 0,0=0
+    COMMAND_TYPES,
+    COMMAND_OTHER = COMMAND_TYPES  // Malformed lines and reports, not recorded
+};
+
+/**
+ * @brief States of the play() state machine.
+ */
+enum PlayState {
+    PLAY_INPUT = 0,  // Waiting for a command line
+    PLAY_OVER        // Saved, won or ended
+};
+
+/**
+ * @brief Cancellation shared by every worker of a solve.
+ *
+ * Set once, by whoever stops the work first. The workers read it with a
+ * relaxed load every CHECK_INTERVAL nodes, so it costs nothing on the hot
+ * path and a cancel is seen within microseconds.
+ */
+typedef struct {
+    atomic_int reason;  // StopReason of the cancel, STOP_NONE while the work goes on
+} CancelToken;
+
+/**
+ * @brief Working state of the backtracking solver.
+ */
+typedef struct Solver {
+    int size;                 // Size of the square
+    int grid[N][N];           // Working square, 0 for empty cells
+    unsigned int rowUsed[N];  // Values placed in each row
+    unsigned int colUsed[N];  // Values placed in each column
+    long limit;               // Stop after this many solutions
+    long solutions;           // Solutions found so far
+    long nodes;               // Search nodes visited
+    long backtracks;          // Values taken back after a subtree without a new solution
+    long propagations;        // Passes of the propagation loop
+    long nakedSingles;        // Cells placed because a single value was left
+    long hiddenSingles;       // Cells placed because a value had a single place in a row or column
+    long forcedChoices;       // Search nodes whose chosen cell had a single candidate
+    int depth;                // Current search depth
+    int peakDepth;            // Deepest search depth reached
+    int solution[N][N];       // First solution found
+    CancelToken *token;       // Stops the search once cancelled, NULL if never cancelled
+    double deadline;          // wallSeconds() time at which the search gives up, 0 for none
+    long nodeLimit;           // Nodes after which the search gives up, 0 for none
+    int stopped;              // StopReason of the search
+    int deepest[N][N];        // Deepest consistent partial assignment reached
+    void (*progress)(struct Solver *solver); // Called every CHECK_INTERVAL nodes, NULL for none
+    void *owner;              // Argument of progress
+    uint64_t seed;            // Seed of searchRestarts()
+    uint64_t rng[4];          // xoshiro256** state of the randomized search
+    long failLimit;           // Backtracks after which a randomized run restarts, 0 for none
+    long restarts;            // Restarts of searchRestarts() so far
+} Solver;
+
+/**
+ * @brief Budget and resources of a solve.
+ */
+typedef struct {
+    double seconds;      // Wall-clock budget, 0 for none
+    long nodes;          // Search node budget, 0 for none
+    int threads;         // Worker threads, 0 or 1 to search on the calling thread only
+    CancelToken *token;  // Cancels the solve from outside, NULL for none
+    int hangup;          // Socket whose peer hanging up cancels the solve, 0 for none
+    int probe;           // 1 while a half-closed peer may still be sent a 100 Continue to learn if it is gone
+    double checked;      // wallSeconds() of the last hang-up check
+} SolveBudget;
+
+/**
+ * @brief Shared state of a search split over worker threads.
+ *
+ * The subtrees below the first levels of the tree are queued and taken by
+ * the workers one at a time. Each worker searches with its own Solver and
+ * publishes its counts here every CHECK_INTERVAL nodes.
+ */
+typedef struct ParallelSearch {
+    Solver *root;                    // Solver the search was started on, receives the totals
+    Solver *workers;                 // One solver per worker, the first one runs on the calling thread
+    int threads;                     // Number of worker solvers
+    int claimed;                     // Worker solvers handed out so far, guarded by the pool lock
+    int running;                     // Pool threads still running a worker, guarded by the pool lock
+    struct ParallelSearch *next;     // Next search waiting for pool threads
+    int (*tasks)[N][N];              // Squares at the roots of the queued subtrees
+    int taskCount;                   // Number of queued subtrees
+    atomic_int nextTask;             // Next subtree to hand out
+    atomic_long nodes;               // Nodes published by the workers and the expansion
+    atomic_long solutions;           // Solutions published by the workers
+    long published[MAX_THREADS][2];  // Nodes and solutions each worker published so far
+    CancelToken token;               // Token of the search when the root has none
+    pthread_mutex_t hookLock;        // Held by the worker running the progress hook of the root
+    int perf;                        // 1 when the caller measures the search with --perf, so pool threads measure too
+} ParallelSearch;
+
+/**
+ * @brief Threads that run the helper workers of parallel searches.
+ *
+ * Started on first use and kept for the life of the process, so a solve
+ * does not pay for thread creation and a traced run keeps one ring per
+ * pool thread.
+ */
+typedef struct {
+    pthread_mutex_t lock;    // Guards the queue and the claimed and running counts of the searches
+    pthread_cond_t ready;    // Signalled when a search is queued
+    pthread_cond_t done;     // Signalled when a pool thread leaves a search
+    ParallelSearch *queue;   // Searches still wanting helpers, oldest first
+    int threads;             // Pool threads started
+} WorkerPool;
+
+/**
+ * @brief A node of a dancing links matrix.
+ */
+typedef struct {
+    int left, right;  // Neighbours in the row, or in the header list for headers
+    int up, down;     // Neighbours in the column
+    int column;       // Header of the column
+    int row;          // Candidate (i*size + j)*size + v-1 of the node, -1 for headers
+} LinkNode;
+
+/**
+ * @brief Exact cover matrix of a Latin square completion for Algorithm X.
+ *
+ * The columns are the cells, the values of each row and the values of
+ * each column still to fill; the rows are the candidates of the empty cells.
+ */
+typedef struct {
+    LinkNode *nodes;  // Root at 0, then the column headers, then the candidate nodes
+    int *sizes;       // Nodes left in each column, by header
+    int *chosen;      // Candidates chosen on the current path
+    int count;        // Nodes in use
+} DancingLinks;
+
+/**
+ * @brief A backend racing in the portfolio.
+ */
+typedef struct {
+    char *name;                   // Name printed in the report
+    void (*run)(Solver *solver);  // Search of the backend
+    Solver solver;                // Its solver, which also holds its results
+    double seconds;               // Time it ran for
+    int won;                      // 1 if it finished first
+} PortfolioEntry;
+
+/**
+ * @brief Progress of a --count run.
+ */
+typedef struct {
+    double start;      // wallSeconds() when the count started
+    double last;       // wallSeconds() of the last progress line
+    double estimate;   // Estimated nodes of the search tree
+} CountProgress;
+
+/**
+ * @brief State of a game being played.
+ */
+typedef struct {
+    int sudoku[N][N];  // Cell values, negative for the fixed cells
+    int size;          // Size of the square
+    char *file;        // Base file of the game
+    MoveLog log;       // Log of the accepted moves
+    int quiet;         // 1 to print only results and errors (script mode)
+    int state;         // PlayState of the game
+    unsigned int rowMask[N];  // Values present in each row, bit v-1 for value v
+    unsigned int colMask[N];  // Values present in each column
+    unsigned int cand[N][N];  // Candidate values of each empty cell, 0 for filled cells
+    int base[N][N];           // Copy of the square handed to the background solve
+    atomic_int solveState;    // SolveState of the background solve
+    int solutions;            // Completions of the loaded square, capped at 2
+    int solution[N][N];       // The completion, valid when solutions is 1
+    void (*onMove)(void *owner, int i, int j, int val); // Called for each accepted move, NULL for none
+    void *owner;              // Argument of onMove
+    char *out;                // Output buffer of a server session, NULL to print to stdout
+    int outLen;               // Bytes held in the output buffer
+    int outCap;               // Capacity of the output buffer
+} Game;
+
+/**
+ * @brief A message of the game server shared by every spectator of a game.
+ *
+ * Each accepted command line of a player is encoded once as a delta
+ * "D <id> i,j=val[;i,j=val...]" and the same buffer is queued to every
+ * spectator; it returns to the slab allocator when the last one sent it.
+ */
+typedef struct {
+    int refs;                 // Spectator queues holding the message
+    int len;                  // Length of the message
+    char data[DELTA_BYTES];   // The encoded message
+} Broadcast;
+
+/**
+ * @brief A client connection of the game server.
+ *
+ * A session either plays its own game or, after "watch <id>", follows the
+ * game of another session as a spectator.
+ */
+typedef struct Session {
+    int fd;                            // Socket of the connection
+    int id;                            // Index of the session in the server registry
+    int closing;                       // 1 to close the connection once the output is sent
+    int dropped;                       // 1 if a spectator fell SPECTATOR_QUEUE messages behind
+    int outSent;                       // Bytes of the output buffer already sent
+    int inLen;                         // Bytes held in the input buffer
+    char in[LINE_LEN];                 // Input not yet split into command lines
+    struct Session *watching;          // Game followed by a spectator, NULL for players
+    struct Session *watchers;          // First spectator of the game of a player
+    struct Session *prevWatcher;       // Previous spectator of the same game
+    struct Session *nextWatcher;       // Next spectator of the same game
+    Broadcast *queue[SPECTATOR_QUEUE]; // Ring of broadcasts waiting to be sent
+    int queueHead;                     // Index of the oldest queued broadcast
+    int queueCount;                    // Queued broadcasts
+    int queueSent;                     // Bytes of the oldest broadcast already sent
+    char delta[DELTA_BYTES];           // Moves of the command line being executed
+    int deltaLen;                      // Length of the delta
+    Game game;                         // The game of the session
+    char out[];                        // Output not yet sent, SESSION_OUT_BYTES(n) bytes
+} Session;
+
+/**
+ * @brief A parsed HTTP/1.1 request.
+ */
+typedef struct {
+    char method[8];   // Request method
+    char path[64];    // Request path
+    char *body;       // Request body, inside the connection buffer
+    int bodyLen;      // Length of the body
+    int keepAlive;    // 1 if the connection stays open after the response
+    int http11;       // 1 for an HTTP/1.1 request, which may be sent interim 1xx responses
+    int fd;           // Connection the request arrived on
+} HttpRequest;
+
+/**
+ * @brief Connections accepted by the HTTP API and waiting for a worker.
+ */
+typedef struct {
+    int fds[HTTP_QUEUE];     // Ring of connection sockets
+    int head;                // Index of the oldest connection
+    int count;               // Connections in the ring
+    pthread_mutex_t lock;    // Protects the ring
+    pthread_cond_t ready;    // Signalled when a connection is queued
+} ConnQueue;
+
+/**
+ * @brief State of the engine protocol.
+ */
+typedef struct {
+    Game game;             // The game driven by the frontend
+    pthread_t thread;      // Thread of the running solve
+    atomic_int searching;  // 1 while a solve runs
+    int started;           // 1 while the solve thread is not joined yet
+    CancelToken cancel;    // Cancelled by stop, shared by the workers of the running solve
+    SolveBudget budget;    // Budget of the running solve
+} Engine;
+
+/**
+ * @brief A size class of the slab allocator.
+ */
+typedef struct {
+    size_t objectSize;  // Bytes of an object of the class
+    void *free;         // Free objects, linked through their first word
+    atomic_long slabs;  // Slabs of SLAB_BYTES allocated for the class
+    atomic_long bytes;  // Bytes allocated for the class
+    atomic_long inUse;  // Objects handed out
+} SlabClass;
+
+/**
+ * @brief Slab allocator of the game server.
+ *
+ * A session of order n holds its game and an output buffer sized for the
+ * rendering of an n x n square, so there is one fixed-size class per order;
+ * class 0 holds the Broadcast buffers.
+ * Objects are carved from SLAB_BYTES slabs and recycled through the free list
+ * of their class; slabs are never returned, so once the server has grown to
+ * its peak load connecting and disconnecting clients does no malloc or free.
+ */
+typedef struct {
+    SlabClass classes[N+1];  // Size class of each order
+} SlabAllocator;
+
+/**
+ * @brief State of the game server.
+ */
+typedef struct {
+    int epfd;              // The epoll instance
+    int listener;          // The listening socket
+    Game *game;            // The loaded game every session starts from
+    SlabAllocator slab;    // Allocator of the sessions and broadcasts
+    Session **sessions;    // Registry of the sessions by id
+    int capacity;          // Slots of the registry
+    int metricsListener;   // Listening socket of the metrics endpoint
+} Server;
+
+/**
+ * @brief Counters exported by the metrics endpoint.
+ *
+ * Updated with relaxed atomics by the threads doing the work, so a scrape
+ * never takes a lock the event loop needs.
+ */
+typedef struct {
+    atomic_long sessions;       // Sessions connected
+    atomic_long sessionsTotal;  // Sessions accepted since startup
+    atomic_long moves;          // Moves applied by every game
+    atomic_long solves;         // Searches run
+} Metrics;
+
+static Metrics metrics;  // Counters of the process
+
+static int solveThreads = 1;  // Worker threads of the engine, HTTP and --count searches, set by --threads
+static WorkerPool workerPool = {  // Helper threads shared by the parallel searches
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .ready = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER
+};
+
+/**
+ * @brief Solver counters merged from every finished solver.
+ *
+ * Each solver counts into its own Solver struct, which only its thread
+ * touches, and adds them here once when it finishes.
+ */
+typedef struct {
+    long solves;          // Solvers merged
+    long nodes;           // Search nodes visited
+    long backtracks;      // Values taken back after a subtree without a new solution
+    long propagations;    // Passes of the propagation loop
+    long nakedSingles;    // Cells placed because a single value was left
+    long hiddenSingles;   // Cells placed because a value had a single place in a row or column
+    long forcedChoices;   // Search nodes whose chosen cell had a single candidate
+    int peakDepth;        // Deepest search depth reached
+} SolverStats;
+
+static SolverStats statsTotal;                              // Counters of the finished solvers
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER; // Guards statsTotal
+static int statsFormat = STATS_OFF;                         // StatsFormat printed at exit
+static double statsStart;                                   // wallSeconds() at startup
+static atomic_int exitSignal;                               // Signal that ended the run, 0 if none
+
+/**
+ * @brief Hardware counters of one thread, read as a single group.
+ *
+ * Opened by the first perfBegin() on the thread and closed when it exits.
+ * The first counter that opens leads the group, so the kernel schedules
+ * every counter over the same intervals and the ratios between them hold.
+ */
+typedef struct {
+    int leader;                                  // Descriptor of the group leader, -1 when no counter opened
+    int fds[PERF_COUNTERS];                      // Counter descriptors, -1 when unavailable
+    int slots[PERF_COUNTERS];                    // Position of each counter in a group read, -1 when unavailable
+    unsigned long long last[PERF_COUNTERS + 3];  // Previous group read: count, time enabled, time running, values
+    int active;                                  // 1 between perfBegin() and perfStop()
+} PerfGroup;
+
+/**
+ * @brief Counters started by perfBegin() for one phase on the calling thread.
+ */
+typedef struct {
+    PerfGroup *group;  // Group of the thread, NULL when --perf is off or no counter opened
+} PerfSample;
+
+/**
+ * @brief Hardware counter totals of one phase.
+ */
+typedef struct {
+    long runs;                        // Phases measured
+    long nodes;                       // Search nodes or propagation passes
+    long long counts[PERF_COUNTERS];  // Counter values
+    int missing[PERF_COUNTERS];       // Whether a counter could not be opened
+    int scaled;                       // Whether multiplexed counts were scaled by time enabled over time running
+} PerfTotals;
+
+static int perfEnabled;                                      // Whether --perf was given
+static PerfTotals perfTotals[PERF_PHASES];                   // Totals of each phase
+static pthread_mutex_t perfLock = PTHREAD_MUTEX_INITIALIZER; // Guards perfTotals
+static atomic_int perfError;                                 // errno of the first failed open, 0 if none
+static pthread_key_t perfKey;                                // Closes the counter group of an exiting thread
+static _Thread_local PerfGroup *perfGroup;                   // Counter group of the calling thread
+
+/**
+ * @brief Log-bucket latency histogram in the style of HdrHistogram.
+ *
+ * Values below 1<<LATENCY_SUB_BITS ns get a bucket each; above that every
+ * power of two is split into 1<<LATENCY_SUB_BITS equal buckets, so the
+ * relative error stays bounded at any scale.
+ */
+typedef struct {
+    atomic_long count;                     // Values recorded
+    atomic_long sum;                       // Sum of the values recorded, in nanoseconds
+    atomic_long max;                       // Largest value recorded, in nanoseconds
+    atomic_long buckets[LATENCY_BUCKETS];  // Values recorded in each bucket
+} LatencyHistogram;
+
+static LatencyHistogram latencies[COMMAND_TYPES];  // Command latencies by CommandType
+
+/**
+ * @brief A span recorded by the tracer.
+ */
+typedef struct {
+    const char *name;  // Span name, a string literal
+    double start;      // Start time in microseconds
+    double duration;   // Duration in microseconds
+} TraceEvent;
+
+/**
+ * @brief Per-thread ring buffer of trace spans.
+ *
+ * Only its own thread writes a ring, so recording a span takes no lock;
+ * head is published with release ordering for the dump at exit.
+ */
+typedef struct TraceRing {
+    int tid;                          // Thread id in the trace
+    const char *name;                 // Thread name in the trace
+    atomic_long head;                 // Spans recorded so far
+    struct TraceRing *next;           // Next ring in the list of all rings
+    struct TraceRing *nextFree;       // Next ring in the free list, guarded by traceLock
+    TraceEvent events[TRACE_EVENTS];  // The last TRACE_EVENTS spans
+} TraceRing;
+
+static char *traceFile;                      // --trace output, NULL when tracing is off
+static _Atomic(TraceRing *) traceRings;      // Rings of every traced thread
+static atomic_int traceThreads;              // Thread ids handed out so far
+static _Thread_local TraceRing *traceRing;   // Ring of the calling thread
+static TraceRing *traceFree;                 // Rings left by exited threads, handed to new ones
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER; // Guards traceFree
+static pthread_key_t traceKey;               // Frees the ring of an exiting thread
 
 /**
  * @brief Reads a Latin square from a file.
@@ -39,344 +635,5233 @@ void readLatinSquare(char file[], int sudoku[][N],int *n);
 void displayLatinSquare(int sudoku[][N], int size);
 
 /**
- * @brief Plays the Latin square game.
- * 
- * Allows the user to interact with the game, inserting values, checking 
- * validity of moves, and saving the game state.
- * 
+ * @brief Renders the Latin square to a buffer.
+ *
+ * Produces the same layout as displayLatinSquare().
+ *
  * @param sudoku The 2D array representing the Latin square.
  * @param size The size of the square.
- * @param file The file to save the game state to.
+ * @param buf The buffer of at least RENDER_BYTES(size) bytes.
+ * @return The length of the rendered text.
+ */
+int renderLatinSquare(int sudoku[][N], int size, char buf[]);
+
+/**
+ * @brief Prints a message of a game.
+ *
+ * Messages go to stdout, or to the output buffer of a server session.
+ *
+ * @param game The game.
+ * @param format The printf format of the message.
  * @return void
  */
-void play(int sudoku[][N], int size, char file[]);
+void gamePrintf(Game *game, const char *format, ...);
 
 /**
- * @brief Prints the commands for the game.
+ * @brief Prints the square of a game.
  *
+ * Goes to stdout, or to the output buffer of a server session when it has
+ * room for a whole rendering; a session short of room skips the square.
+ *
+ * @param game The game.
  * @return void
  */
-void printCommands();
+void gameRender(Game *game);
 
 /**
- * @brief Checks if a move is valid.
+ * @brief Plays the Latin square game.
  * 
- * Validates if a move is allowed based on the current state of the Latin square.
+ * Allows the user to interact with the game, inserting values, checking 
+ * validity of moves, and saving the game state. This is the terminal driver
+ * of the playStart()/playFeed() state machine: commands are read line by
+ * line from stdin; the game ends on the save command, on a win or at the end
+ * of the input, in which case the progress is kept in the move log only.
  * 
- * @param sudoku The 2D array representing the Latin square.
- * @param size The size of the square.
- * @param val The value to be inserted.
+ * @param game The game to play.
+ * @return void
+ */
+void play(Game *game);
+
+/**
+ * @brief Starts a game and prompts for the first command.
+ *
+ * play() and the game server drive a game through playStart() and
+ * playFeed(), so one thread can interleave any number of games, each one
+ * waiting for its next line.
+ *
+ * @param game The game.
+ * @return void
+ */
+void playStart(Game *game);
+
+/**
+ * @brief Resumes a game with one command line.
+ *
+ * Executes the line, then either prompts for the next one or ends the game,
+ * saving it when it has a base file.
+ *
+ * @param game The game.
+ * @param line The command line.
+ * @return The PlayState of the game after the line.
+ */
+int playFeed(Game *game, char line[]);
+
+/**
+ * @brief Prints the square and the prompt of a game.
+ *
+ * @param game The game.
+ * @return void
+ */
+void playPrompt(Game *game);
+
+/**
+ * @brief Executes one command line of the game.
+ *
+ * A line holds one command or several moves separated by ';', for example
+ * 1,1=2;1,2=3. The moves of a line are validated in order, each against the
+ * square left by the previous ones, and applied all-or-nothing.
+ *
+ * @param game The game the command applies to.
+ * @param line The command line, in the format i,j=val[;i,j=val...].
+ * @return 0 if the command saves and ends the game, 1 otherwise.
+ */
+int playCommand(Game *game, char line[]);
+
+/**
+ * @brief Returns the type of a command line.
+ *
+ * @param line The command line.
+ * @return The CommandType of the line.
+ */
+int commandType(char line[]);
+
+/**
+ * @brief Returns the histogram bucket of a latency.
+ *
+ * @param ns The latency in nanoseconds.
+ * @return The bucket index.
+ */
+int latencyBucket(unsigned long ns);
+
+/**
+ * @brief Records the latency of a command.
+ *
+ * @param type The CommandType of the command.
+ * @param start The wallSeconds() time at which the command was received.
+ * @return void
+ */
+void recordLatency(int type, double start);
+
+/**
+ * @brief Returns a percentile of a latency histogram.
+ *
+ * @param histogram The histogram.
+ * @param percentile The percentile, between 0 and 100.
+ * @return The highest latency of the bucket holding the percentile, in nanoseconds.
+ */
+long latencyPercentile(LatencyHistogram *histogram, double percentile);
+
+/**
+ * @brief Prints the latency percentiles of every command type.
+ *
+ * The histograms are shared by all the games of the process, so a server
+ * session sees the latencies of every session.
+ *
+ * @param game The game the report is printed to.
+ * @return void
+ */
+void printLatencies(Game *game);
+
+/**
+ * @brief Computes the candidate cache of a game from scratch.
+ *
+ * @param game The game.
+ * @return void
+ */
+void initCandidates(Game *game);
+
+/**
+ * @brief Updates the candidate cache after a cell changed.
+ *
+ * Only the row and column of the cell are recomputed, in O(size).
+ *
+ * @param game The game.
+ * @param row The 0-based row of the changed cell.
+ * @param col The 0-based column of the changed cell.
+ * @return void
+ */
+void updateCandidates(Game *game, int row, int col);
+
+/**
+ * @brief Prints the candidate values of a cell.
+ *
+ * @param game The game.
  * @param i The row index.
  * @param j The column index.
- * @return 1 if the move is valid, 0 otherwise.
+ * @return void
  */
-int validMove(int sudoku[][N], int size, int val, int i, int j);
+void printCandidates(Game *game, int i, int j);
 
 /**
- * @brief Validates the input provided by the user.
- * 
- * Checks if the row, column, and value entered by the user are within valid ranges.
- * 
- * @param i Row index.
- * @param j Column index.
- * @param val The value to be inserted.
- * @param size The size of the square.
- * @return 1 if input is valid, 0 otherwise.
+ * @brief Finds a cell whose value is forced by the current square.
+ *
+ * Looks for an empty cell with a single candidate, then for a value that
+ * fits in only one cell of a row or column.
+ *
+ * @param game The game.
+ * @param row Pointer where the 0-based row of the cell is stored.
+ * @param col Pointer where the 0-based column of the cell is stored.
+ * @return The forced value, 0 if no cell is forced.
  */
-int checkInput(int i, int j, int val, int size);
+int findForcedCell(Game *game, int *row, int *col);
 
 /**
- * @brief Checks if the game is complete.
- * 
- * Validates if the Latin square is correctly filled and the game is won.
- * 
+ * @brief Counts the completions of a Latin square.
+ *
+ * Backtracks over the empty cells, always branching on the cell with the
+ * fewest candidates, until limit completions are found or the budget runs
+ * out. A search stopped by its budget before finding any completion leaves
+ * the deepest consistent partial assignment it reached in solution.
+ *
  * @param sudoku The 2D array representing the Latin square.
  * @param size The size of the square.
- * @return 1 if the game is won, 0 otherwise.
+ * @param solution The 2D array where the first completion, or the partial assignment, is stored.
+ * @param limit The number of completions after which the search stops.
+ * @param budget The time and node budget, NULL for none.
+ * @param stopped Pointer where the StopReason is stored, NULL if not needed.
+ * @return The number of completions found, at most limit.
  */
-int checkGame(int sudoku[][N], int size);
+long solveLatinSquare(int sudoku[][N], int size, int solution[][N], long limit, SolveBudget *budget, int *stopped);
 
 /**
- * @brief Saves the current state of the Latin square to a file.
- * 
- * Writes the current game state to an output file.
- * 
- * @param sudoku The 2D array representing the Latin square.
- * @param size The size of the square.
- * @param file The file to save the state to.
+ * @brief Applies a budget to a solver.
+ *
+ * @param solver The solver.
+ * @param budget The budget, NULL for none.
  * @return void
  */
-void writeLatinSquare(int sudoku[][N], int size, char file[]);
+void applyBudget(Solver *solver, SolveBudget *budget);
 
 /**
- * @brief The main function to run the game.
- * 
- * @param argc The number of command-line arguments.
- * @param argv The command-line arguments.
- * @return void
+ * @brief Finds a hint for the current square of a game.
+ *
+ * Takes a forced cell when there is one. Otherwise picks the cell the search
+ * branches on first and, while every filled cell still agrees with the
+ * completion solved when the square was loaded, reads its value there.
+ * Failing that it checks the square with a short propagation pass, then
+ * solves it within HINT_SECONDS, HINT_SERVER_SECONDS for a server session,
+ * and gives the value from the completion or from the deepest partial
+ * assignment if the budget ran out, so a hint always answers in time.
+ *
+ * @param game The game.
+ * @param row Pointer where the 0-based row of the cell is stored.
+ * @param col Pointer where the 0-based column of the cell is stored.
+ * @param val Pointer where the value is stored.
+ * @return The HintKind of the answer.
  */
-void main(int argc, char *argv[]){
-    int sudoku[N][N] = {0};
-    int size = 0;
-    if(argc != 2){
-        printf("Missing arguments\n");
-        return;    
+int hintCell(Game *game, int *row, int *col, int *val);
+
+/**
+ * @brief Loads a Latin square into a solver.
+ *
+ * @param solver The solver.
+ * @param sudoku The 2D array representing the Latin square.
+ * @param size The size of the square.
+ * @return 1 if the square has no repeated value in a row or column, 0 otherwise.
+ */
+int initSolver(Solver *solver, int sudoku[][N], int size);
+
+/**
+ * @brief Fills the cells forced by the square held by a solver.
+ *
+ * Repeatedly places values that are the only candidate of a cell or that fit
+ * in only one cell of a row or column, and stops when a cell or a row/column
+ * value is left without any place.
+ *
+ * @param solver The solver.
+ * @param deadline The wallSeconds() time at which to give up, 0 for none.
+ * @return The Propagation outcome.
+ */
+int propagateSolver(Solver *solver, double deadline);
+
+/**
+ * @brief Places a value in the square held by a solver.
+ *
+ * @param solver The solver.
+ * @param row The 0-based row.
+ * @param col The 0-based column.
+ * @param bit The bit of the value.
+ * @return void
+ */
+void placeValue(Solver *solver, int row, int col, unsigned int bit);
+
+/**
+ * @brief Searches the completions of the square held by a solver.
+ *
+ * Every CHECK_INTERVAL nodes the search polls the cancel token and the
+ * deadline of the solver, and unwinds when either one fires.
+ *
+ * @param solver The solver.
+ * @return void
+ */
+void searchLatinSquare(Solver *solver);
+
+/**
+ * @brief Counts a search node and polls the stop conditions of a solver.
+ *
+ * Reads the cancel token and the deadline every CHECK_INTERVAL nodes, and
+ * calls the progress hook, so every search backend stops the same way.
+ *
+ * @param solver The solver.
+ * @return The StopReason of the solver, STOP_NONE to go on.
+ */
+int countNode(Solver *solver);
+
+/**
+ * @brief Searches the completions of a square, propagating at every node.
+ *
+ * Runs propagateSolver() before each branching, trading slower nodes for a
+ * much smaller tree on squares where the singles cascade.
+ *
+ * @param solver The solver.
+ * @return void
+ */
+void searchPropagating(Solver *solver);
+
+/**
+ * @brief Searches the completions of a square as an exact cover problem.
+ *
+ * Builds the dancing links matrix of the square and runs Knuth's
+ * Algorithm X on it, always covering the column with the fewest rows.
+ *
+ * @param solver The solver.
+ * @return void
+ */
+void solveLinks(Solver *solver);
+
+/**
+ * @brief Runs Algorithm X on a dancing links matrix.
+ *
+ * @param links The matrix.
+ * @param solver The solver that counts the nodes and keeps the solution.
+ * @param depth The number of candidates chosen so far.
+ * @return void
+ */
+void searchLinks(DancingLinks *links, Solver *solver, int depth);
+
+/**
+ * @brief Removes a column and the rows that meet it from a dancing links matrix.
+ *
+ * @param links The matrix.
+ * @param column The header of the column.
+ * @return void
+ */
+void coverColumn(DancingLinks *links, int column);
+
+/**
+ * @brief Puts back a column removed by coverColumn().
+ *
+ * @param links The matrix.
+ * @param column The header of the column.
+ * @return void
+ */
+void uncoverColumn(DancingLinks *links, int column);
+
+/**
+ * @brief Completes a square by min-conflicts local search.
+ *
+ * Fills every row with its missing values, then repeatedly takes a cell
+ * whose value repeats in its column and swaps it with the free cell of its
+ * row that removes the most repeats; LOCAL_NOISE percent of the swaps are
+ * random. Finds a completion fast when there are many, but never proves
+ * that there is none, so it runs until it is stopped.
+ *
+ * @param solver The solver.
+ * @return void
+ */
+void searchLocal(Solver *solver);
+
+/**
+ * @brief Searches the completions of a square with randomized restarts.
+ *
+ * Runs searchRandomized() seeded with the seed of the solver, cutting each
+ * run off after RESTART_UNIT times the next term of the Luby sequence
+ * (1, 1, 2, 1, 1, 2, 4, ...) of backtracks and starting over with the
+ * random sequence where it left off. A run that ends under its cutoff has
+ * explored its whole tree, so unsolvable squares are still proven so. The
+ * same seed always gives the same runs.
+ *
+ * @param solver The solver.
+ * @return void
+ */
+void searchRestarts(Solver *solver);
+
+/**
+ * @brief One run of the randomized search, stopped at the backtrack cutoff.
+ *
+ * Like searchLatinSquare() but breaks ties between the cells with the
+ * fewest candidates at random and tries the values in random order.
+ *
+ * @param solver The solver.
+ * @return void
+ */
+void searchRandomized(Solver *solver);
+
+/**
+ * @brief Picks the branching cell of a randomized search node.
+ *
+ * Chooses the empty cell with the fewest candidates, a random one on ties.
+ *
+ * @param solver The solver.
+ * @param row Pointer where the row of the cell is stored, -1 if the square is full.
+ * @param col Pointer where the column of the cell is stored.
+ * @param cand Pointer where the candidates of the cell are stored.
+ * @return The number of candidates of the cell.
+ */
+int pickCellRandom(Solver *solver, int *row, int *col, unsigned int *cand);
+
+/**
+ * @brief Returns a term of the Luby sequence 1, 1, 2, 1, 1, 2, 4, 1, 1, 2, ...
+ *
+ * @param i The 1-based index of the term.
+ * @return The term.
+ */
+long lubyTerm(long i);
+
+/**
+ * @brief Races every search backend on a square and prints the winner.
+ *
+ * Backtracking, propagating backtracking, dancing links, local search and
+ * randomized restarts each run on their own thread with the same budget.
+ * The first to finish, with a completion or a proof that there is none,
+ * cancels the others.
+ *
+ * @param sudoku The 2D array representing the Latin square.
+ * @param size The size of the square.
+ * @param budget The time and node budget of every backend.
+ * @param seed The seed of the randomized restarts.
+ * @return void
+ */
+void runPortfolio(int sudoku[][N], int size, SolveBudget *budget, uint64_t seed);
+
+/**
+ * @brief Runs one backend of the portfolio.
+ *
+ * @param arg The PortfolioEntry of the backend.
+ * @return NULL
+ */
+void *portfolioWorker(void *arg);
+
+/**
+ * @brief Searches the completions of the square held by a solver on several threads.
+ *
+ * Expands the first levels of the tree breadth-first until there are
+ * TASKS_PER_THREAD subtrees per thread, then lets the workers take them
+ * from a shared queue. The calling thread runs the first worker and the
+ * threads of the worker pool the others. The workers share the cancel
+ * token of the solver, or a token of their own when it has none; the first
+ * one to run out of budget or to complete the limit cancels the others. The totals, the
+ * first solution and the deepest partial assignment end up in the solver
+ * as if searchLatinSquare() had run alone.
+ *
+ * @param solver The solver, loaded and budgeted.
+ * @param threads The number of worker threads, the calling thread included.
+ * @return void
+ */
+void searchParallel(Solver *solver, int threads);
+
+/**
+ * @brief Starts pool threads until the pool has at least the given number.
+ *
+ * @param threads The number of pool threads needed.
+ * @return void
+ */
+void growPool(int threads);
+
+/**
+ * @brief Runs the helper workers of the queued parallel searches, forever.
+ *
+ * @param arg Unused.
+ * @return NULL
+ */
+void *poolThread(void *arg);
+
+/**
+ * @brief Runs one worker of a parallel search until the queue is empty or the search is cancelled.
+ *
+ * @param arg The Solver of the worker.
+ * @return NULL
+ */
+void *parallelWorker(void *arg);
+
+/**
+ * @brief Publishes the counts of a worker and cancels the search on the shared limits.
+ *
+ * Progress hook of the workers. Whichever worker gets the hook lock also
+ * hands the totals to the progress hook of the root solver, so the hook keeps
+ * running while any worker does.
+ *
+ * @param worker The Solver of the worker.
+ * @return void
+ */
+void parallelCheck(Solver *worker);
+
+/**
+ * @brief Loads the square of a queued subtree into a worker.
+ *
+ * @param worker The Solver of the worker.
+ * @param task The square at the root of the subtree.
+ * @return void
+ */
+void loadTask(Solver *worker, int task[][N]);
+
+/**
+ * @brief Cancels a token, keeping the first reason when it is cancelled twice.
+ *
+ * @param token The token.
+ * @param reason The StopReason.
+ * @return 1 if this call cancelled the token, 0 if it already was.
+ */
+int cancelToken(CancelToken *token, int reason);
+
+/**
+ * @brief Cancels a solve whose HTTP client hung up.
+ *
+ * Progress hook of HTTP solves; polls the socket every HANGUP_SECONDS.
+ * A peer that only shut down its sending side may still read the answer,
+ * so a bare end of stream is confirmed by sending an HTTP/1.1 client a
+ * 100 Continue: a peer that is gone answers it with a reset. Without that
+ * probe only an error or a full hang-up cancels the solve.
+ *
+ * @param solver The solver, owned by its SolveBudget.
+ * @return void
+ */
+void watchHangup(Solver *solver);
+
+/**
+ * @brief Picks the branching cell of a search node.
+ *
+ * Chooses the empty cell with the fewest candidates, the first one on ties.
+ *
+ * @param solver The solver.
+ * @param row Pointer where the row of the cell is stored, -1 if the square is full.
+ * @param col Pointer where the column of the cell is stored.
+ * @param cand Pointer where the candidates of the cell are stored.
+ * @return The number of candidates of the cell.
+ */
+int pickCell(Solver *solver, int *row, int *col, unsigned int *cand);
+
+/**
+ * @brief Estimates the size of the search tree of a square.
+ *
+ * Knuth's estimator: each probe walks from the root to a leaf, branching
+ * like searchLatinSquare() but on one random candidate, and multiplies the
+ * branching factors on the way. The running products summed over the depths
+ * are an unbiased estimate of the node count; the product at a complete
+ * square estimates the solutions. The probes are averaged.
+ *
+ * @param sudoku The 2D array representing the Latin square.
+ * @param size The size of the square.
+ * @param probes The number of probes.
+ * @param solutions Pointer where the estimated number of solutions is stored.
+ * @param rate Pointer where the measured nodes per second of the probes is stored.
+ * @return The estimated number of search nodes, 0 if the square is invalid.
+ */
+double estimateTreeSize(int sudoku[][N], int size, int probes, double *solutions, double *rate);
+
+/**
+ * @brief Counts every completion of a square with progress and an ETA.
+ *
+ * Prints the tree size estimate first; with estimateOnly that is all, so a
+ * long count can be judged feasible before it is started. Otherwise the
+ * count runs to the end, printing the share of the estimated nodes visited
+ * and the time left on stderr every PROGRESS_SECONDS.
+ *
+ * @param sudoku The 2D array representing the Latin square.
+ * @param size The size of the square.
+ * @param estimateOnly 1 to stop after the estimate.
+ * @param budget The time and node budget of the count, NULL for none.
+ * @return void
+ */
+void countLatinSquare(int sudoku[][N], int size, int estimateOnly, SolveBudget *budget);
+
+/**
+ * @brief Prints a progress line of a --count run.
+ *
+ * @param solver The counting solver, whose owner is its CountProgress.
+ * @return void
+ */
+void countProgress(Solver *solver);
+
+/**
+ * @brief Solves the loaded square of a game on a background thread.
+ *
+ * The solve works on a copy of the square, so play() never waits for it.
+ *
+ * @param game The game.
+ * @return void
+ */
+void startBackgroundSolve(Game *game);
+
+/**
+ * @brief Entry point of the background solve thread.
+ *
+ * @param arg The Game being solved.
+ * @return NULL
+ */
+void *backgroundSolve(void *arg);
+
+/**
+ * @brief Runs the game server.
+ *
+ * A single-threaded epoll loop serves every connection. Each connection plays
+ * its own copy of the loaded game with the i,j=val commands of play(); the
+ * save command 0,0=0 ends the session. "watch <id>" turns a connection into a
+ * spectator of session id: it gets a snapshot "S <id> <n> <n*n values>",
+ * then one delta per accepted command line and "E <id>" when the game ends.
+ *
+ * @param address TCP port on the loopback interface or unix:<path>.
+ * @param game The loaded game every session starts from.
+ * @param metricsPort Loopback port of the metrics endpoint, NULL for none.
+ * @return void
+ */
+void runServer(char address[], Game *game, char metricsPort[]);
+
+/**
+ * @brief Entry point of the thread serving the metrics endpoint.
+ *
+ * Answers GET /metrics in the Prometheus text format, one connection at a
+ * time. It only reads atomics, so it never blocks the event loop.
+ *
+ * @param arg The Server.
+ * @return NULL
+ */
+void *serveMetrics(void *arg);
+
+/**
+ * @brief Writes the metrics in the Prometheus text format.
+ *
+ * @param out The buffer.
+ * @param cap The capacity of the buffer.
+ * @param slab The slab allocator of the server.
+ * @return The number of bytes written.
+ */
+int writeMetrics(char out[], int cap, SlabAllocator *slab);
+
+/**
+ * @brief Opens the non-blocking listening socket of the server.
+ *
+ * @param address TCP port on the loopback interface or unix:<path>.
+ * @return The socket, -1 on error.
+ */
+int openListener(char address[]);
+
+/**
+ * @brief Accepts the pending connections of the server.
+ *
+ * @param server The server.
+ * @return void
+ */
+void acceptSessions(Server *server);
+
+/**
+ * @brief Handles the epoll events of a session.
+ *
+ * @param server The server.
+ * @param session The session.
+ * @param events The epoll events.
+ * @return void
+ */
+void serveSession(Server *server, Session *session, uint32_t events);
+
+/**
+ * @brief Closes a session or updates the events it waits for.
+ *
+ * @param server The server.
+ * @param session The session.
+ * @return void
+ */
+void updateSession(Server *server, Session *session);
+
+/**
+ * @brief Closes a session and releases its resources.
+ *
+ * Spectators of the session get "E <id>" and are closed once it is sent.
+ *
+ * @param server The server.
+ * @param session The session.
+ * @return void
+ */
+void closeSession(Server *server, Session *session);
+
+/**
+ * @brief Takes an object of a size class from the slab allocator.
+ *
+ * @param slab The slab allocator.
+ * @param class The size class: the order of a session, 0 for a broadcast.
+ * @param size The size of the objects of the class.
+ * @return The object, NULL when out of memory.
+ */
+void *slabAlloc(SlabAllocator *slab, int class, size_t size);
+
+/**
+ * @brief Returns an object to its class of the slab allocator.
+ *
+ * @param slab The slab allocator.
+ * @param class The size class the object was allocated from.
+ * @param object The object.
+ * @return void
+ */
+void slabFree(SlabAllocator *slab, int class, void *object);
+
+/**
+ * @brief Executes the complete command lines received by a session.
+ *
+ * Stops early when the output buffer has no room left for a reply.
+ *
+ * @param server The server.
+ * @param session The session.
+ * @return void
+ */
+void processSession(Server *server, Session *session);
+
+/**
+ * @brief Sends the pending output and broadcasts of a session.
+ *
+ * @param server The server.
+ * @param session The session.
+ * @return 0 on success, -1 if the connection failed.
+ */
+int flushSession(Server *server, Session *session);
+
+/**
+ * @brief Turns a session into a spectator of another one.
+ *
+ * @param server The server.
+ * @param session The new spectator.
+ * @param id The id of the watched session.
+ * @return void
+ */
+void watchSession(Server *server, Session *session, int id);
+
+/**
+ * @brief Records an accepted move in the delta of a session.
+ *
+ * @param owner The Session.
+ * @param i The row index.
+ * @param j The column index.
+ * @param val The inserted value, 0 for a cleared cell.
+ * @return void
+ */
+void recordDelta(void *owner, int i, int j, int val);
+
+/**
+ * @brief Queues a message to every spectator of a session.
+ *
+ * The message is copied once into a shared Broadcast buffer.
+ *
+ * @param server The server.
+ * @param session The watched session.
+ * @param data The message.
+ * @param len The length of the message.
+ * @return void
+ */
+void broadcast(Server *server, Session *session, char data[], int len);
+
+/**
+ * @brief Runs the HTTP/JSON API.
+ *
+ * Accepts connections on the loopback interface and hands them to a pool of
+ * HTTP_WORKERS threads, each serving one keep-alive connection at a time.
+ * Every endpoint takes a POST with a JSON object holding "size" and "board":
+ * /solve, /validate, /count (optional "limit"), /generate (optional "seed",
+ * no board) and /rate.
+ *
+ * @param port The TCP port.
+ * @return void
+ */
+void runHttpServer(char port[]);
+
+/**
+ * @brief Entry point of an HTTP API worker thread.
+ *
+ * @param arg The ConnQueue of the server.
+ * @return NULL
+ */
+void *httpWorker(void *arg);
+
+/**
+ * @brief Serves the requests of a keep-alive HTTP connection until it closes.
+ *
+ * @param fd The connection socket.
+ * @return void
+ */
+void serveHttpConnection(int fd);
+
+/**
+ * @brief Parses an HTTP/1.1 request.
+ *
+ * @param buf The received bytes.
+ * @param len The number of received bytes.
+ * @param req The request to fill.
+ * @return The length of the request, 0 if it is incomplete, -1 if malformed.
+ */
+int parseHttpRequest(char buf[], int len, HttpRequest *req);
+
+/**
+ * @brief Executes an API request.
+ *
+ * @param req The request.
+ * @param out The buffer where the JSON response body is written.
+ * @param cap The capacity of the buffer.
+ * @param status Pointer where the HTTP status code is stored.
+ * @return The length of the response body.
+ */
+int handleApiRequest(HttpRequest *req, char out[], int cap, int *status);
+
+/**
+ * @brief Reads the "board" of a JSON request.
+ *
+ * The board is a list of rows, or a flat list, of integers with 0 for the
+ * empty cells; "size" defaults to the square root of the number of cells.
+ *
+ * @param json The JSON text.
+ * @param len The length of the text.
+ * @param sudoku The 2D array where the board is stored, givens as fixed cells.
+ * @param size Pointer where the size of the board is stored.
+ * @return 1 on success, 0 if the board is malformed.
+ */
+int parseBoardJson(char json[], int len, int sudoku[][N], int *size);
+
+/**
+ * @brief Reads an integer member of a JSON object.
+ *
+ * @param json The JSON text.
+ * @param len The length of the text.
+ * @param key The member name.
+ * @param def The value returned when the member is missing.
+ * @return The value of the member.
+ */
+long jsonLong(char json[], int len, char key[], long def);
+
+/**
+ * @brief Writes a square as a JSON list of rows.
+ *
+ * @param out The buffer.
+ * @param cap The capacity of the buffer.
+ * @param sudoku The 2D array representing the Latin square.
+ * @param size The size of the square.
+ * @return The number of bytes written.
+ */
+int writeBoardJson(char out[], int cap, int sudoku[][N], int size);
+
+/**
+ * @brief Generates a puzzle with a unique completion.
+ *
+ * Shuffles the rows, columns and symbols of the cyclic square, then empties
+ * cells in random order as long as the completion stays unique. The budget
+ * covers every uniqueness check together, and its cancel token and client
+ * hang-up are polled before each check; when it runs out the remaining
+ * cells stay filled, so the puzzle is still unique but has more givens.
+ *
+ * @param sudoku The 2D array where the puzzle is stored.
+ * @param size The size of the square.
+ * @param seed The seed of the random generator.
+ * @param budget The time and node budget of the uniqueness checks, NULL for none.
+ * @return STOP_NONE, or the StopReason that ended the emptying early.
+ */
+int generateLatinSquare(int sudoku[][N], int size, uint64_t seed, SolveBudget *budget);
+
+/**
+ * @brief Rates the difficulty of a puzzle.
+ *
+ * @param sudoku The 2D array representing the puzzle.
+ * @param size The size of the square.
+ * @param nodes Pointer where the search nodes needed to solve it are stored.
+ * @param budget The time and node budget of the search, NULL for none.
+ * @return "easy" if propagation alone solves it, "medium" or "hard" after
+ *         search, "invalid" if it has no completion, "unrated" if the budget
+ *         ran out first.
+ */
+char *rateLatinSquare(int sudoku[][N], int size, long *nodes, SolveBudget *budget);
+
+/**
+ * @brief Returns the next number of a splitmix64 random sequence.
+ *
+ * @param state The state of the sequence.
+ * @return The random number.
+ */
+uint64_t randomNext(uint64_t *state);
+
+/**
+ * @brief Returns the next number of a xoshiro256** random sequence.
+ *
+ * Faster than randomNext() with a far longer period, for the search
+ * tie-breaking that draws numbers at every node.
+ *
+ * @param state The state of the sequence.
+ * @return The random number.
+ */
+uint64_t xoshiroNext(uint64_t state[4]);
+
+/**
+ * @brief Seeds a xoshiro256** sequence from splitmix64, so any seed gives a good state.
+ *
+ * @param state The state to fill.
+ * @param seed The seed.
+ * @return void
+ */
+void xoshiroSeed(uint64_t state[4], uint64_t seed);
+
+/**
+ * @brief Runs the line-oriented engine protocol on stdin and stdout.
+ *
+ * Frontends send one command per line and get structured replies, without
+ * any rendering or help text:
+ *   board <n> <n*n values>  -> ok | error board
+ *   move i,j=val            -> ok | error <reason>
+ *   hint                    -> hint <i> <j> <val> [guess] | hint none | hint dead
+ *   solve [ms [nodes]]      -> solution <n*n values> | nosolution
+ *                              | stopped|timeout|nodelimit partial <n*n values>
+ *   stop                    -> cancels the running solve, which replies stopped
+ *   show                    -> board <n> <n*n values>
+ *   isready                 -> readyok
+ *   quit
+ * A solve runs on its own thread, so stop is read while it searches.
+ *
+ * @return void
+ */
+void runEngine();
+
+/**
+ * @brief Executes one command of the engine protocol.
+ *
+ * @param engine The engine.
+ * @param line The command line.
+ * @return 0 on quit, 1 otherwise.
+ */
+int engineCommand(Engine *engine, char line[]);
+
+/**
+ * @brief Entry point of the engine solve thread.
+ *
+ * @param arg The Engine.
+ * @return NULL
+ */
+void *engineSolve(void *arg);
+
+/**
+ * @brief Prints the commands for the game.
+ *
+ * @return void
+ */
+void printCommands();
+
+/**
+ * @brief Checks if a move is valid.
+ * 
+ * Validates if a move is allowed based on the current state of the Latin square.
+ * 
+ * @param sudoku The 2D array representing the Latin square.
+ * @param size The size of the square.
+ * @param val The value to be inserted.
+ * @param i The row index.
+ * @param j The column index.
+ * @return 1 if the move is valid, 0 otherwise.
+ */
+int validMove(int sudoku[][N], int size, int val, int i, int j);
+
+/**
+ * @brief Checks if a move is valid without printing anything.
+ *
+ * Applies the same rules as validMove() and reports which rule failed.
+ *
+ * @param sudoku The 2D array representing the Latin square.
+ * @param size The size of the square.
+ * @param val The value to be inserted.
+ * @param i The row index.
+ * @param j The column index.
+ * @return MOVE_OK if the move is valid, the failed MoveError otherwise.
+ */
+int checkMove(int sudoku[][N], int size, int val, int i, int j);
+
+/**
+ * @brief Returns the message reported for a failed move check.
+ *
+ * @param err The MoveError returned by checkMove().
+ * @return The message.
+ */
+char *moveErrorMessage(int err);
+
+/**
+ * @brief Validates the input provided by the user.
+ * 
+ * Checks if the row, column, and value entered by the user are within valid ranges.
+ * 
+ * @param i Row index.
+ * @param j Column index.
+ * @param val The value to be inserted.
+ * @param size The size of the square.
+ * @return 1 if input is valid, 0 otherwise.
+ */
+int checkInput(int i, int j, int val, int size);
+
+/**
+ * @brief Checks if the game is complete.
+ * 
+ * Validates if the Latin square is correctly filled and the game is won.
+ * 
+ * @param sudoku The 2D array representing the Latin square.
+ * @param size The size of the square.
+ * @return 1 if the game is won, 0 otherwise.
+ */
+int checkGame(int sudoku[][N], int size);
+
+/**
+ * @brief Saves the current state of the Latin square to a file.
+ * 
+ * Writes the current game state to an output file.
+ * 
+ * @param sudoku The 2D array representing the Latin square.
+ * @param size The size of the square.
+ * @param file The file to save the state to.
+ * @return void
+ */
+void writeLatinSquare(int sudoku[][N], int size, char file[]);
+
+/**
+ * @brief Opens the move log of a game and recovers the moves it holds.
+ *
+ * Replays the moves stored in "<file>.log" on top of the square loaded from
+ * the base file. A log written for a different base square is discarded and a
+ * torn record at the end of the log is cut off, so new moves are appended
+ * right after the last valid one.
+ *
+ * @param log The move log to open.
+ * @param file The name of the base file of the game.
+ * @param sudoku The 2D array holding the square loaded from the base file.
+ * @param size The size of the square.
+ * @return The number of moves recovered from the log.
+ */
+long openMoveLog(MoveLog *log, char file[], int sudoku[][N], int size);
+
+/**
+ * @brief Appends an accepted move to the move log.
+ *
+ * The record is handed to the kernel immediately; fsync is only issued every
+ * LOG_SYNC_BATCH moves.
+ *
+ * @param log The move log.
+ * @param sudoku The 2D array holding the square after the move.
+ * @param size The size of the square.
+ * @param i The row index.
+ * @param j The column index.
+ * @param val The inserted value, 0 for a cleared cell.
+ * @return void
+ */
+void appendMove(MoveLog *log, int sudoku[][N], int size, int i, int j, int val);
+
+/**
+ * @brief Flushes and closes the move log.
+ *
+ * @param log The move log.
+ * @param file The name of the base file of the game.
+ * @param discard 1 to delete the log because the game state was saved.
+ * @return void
+ */
+void closeMoveLog(MoveLog *log, char file[], int discard);
+
+/**
+ * @brief Builds the header that identifies the move log of a base square.
+ *
+ * @param header The LOG_HEADER_BYTES buffer to fill.
+ * @param sudoku The 2D array holding the base square.
+ * @param size The size of the square.
+ * @return void
+ */
+void makeLogHeader(unsigned char header[], int sudoku[][N], int size);
+
+/**
+ * @brief Returns the file offset of a move record in the move log.
+ *
+ * @param move The 0-based index of the move.
+ * @param size The size of the square.
+ * @return The offset of the record.
+ */
+long logMoveOffset(long move, int size);
+
+/**
+ * @brief Writes the full board snapshot record to a buffer.
+ *
+ * @param rec The LOG_SNAPSHOT_BYTES(size) buffer to fill.
+ * @param sudoku The 2D array representing the Latin square.
+ * @param size The size of the square.
+ * @return void
+ */
+void makeLogSnapshot(unsigned char rec[], int sudoku[][N], int size);
+
+/**
+ * @brief Checks a snapshot record of the move log.
+ *
+ * @param rec The snapshot record.
+ * @param size The size of the square.
+ * @return 1 if the record is intact, 0 otherwise.
+ */
+int validLogSnapshot(unsigned char rec[], int size);
+
+/**
+ * @brief Reads a whole file into memory.
+ *
+ * @param file The name of the file.
+ * @param len Pointer where the length of the file is stored.
+ * @return The malloc'ed contents, NULL on error.
+ */
+unsigned char *loadFile(char file[], long *len);
+
+/**
+ * @brief Replays a recorded move log without prompting or rendering.
+ *
+ * Every move is validated with the rules of validMove(); rejected moves are
+ * reported and skipped. Prints the final state and the replay throughput.
+ * When seeking, the nearest snapshot before the target move is restored and
+ * only the moves after it are replayed.
+ *
+ * @param logfile The move log to replay.
+ * @param sudoku The 2D array holding the base square of the log.
+ * @param size The size of the square.
+ * @param seek Number of moves to replay, -1 for the whole log.
+ * @return 0 if every move was accepted, 1 otherwise.
+ */
+int replayMoveLog(char logfile[], int sudoku[][N], int size, long seek);
+
+/**
+ * @brief Returns the current time of the monotonic clock.
+ *
+ * @return The time in seconds.
+ */
+double wallSeconds();
+
+/**
+ * @brief Adds the counters of a finished solver to the totals.
+ *
+ * Does nothing unless --stats was given.
+ *
+ * @param solver The solver.
+ * @return void
+ */
+void mergeSolverStats(Solver *solver);
+
+/**
+ * @brief Prints the solver totals with the wall time, CPU time and peak RSS.
+ *
+ * Registered with atexit() by --stats; prints a table or a JSON object to
+ * stderr.
+ *
+ * @return void
+ */
+void printSolverStats();
+
+/**
+ * @brief Exits through the atexit() handlers when SIGINT or SIGTERM arrives.
+ *
+ * Runs on its own thread with both signals blocked everywhere else, so the
+ * long-running modes still print their statistics and write their trace;
+ * exitBySignal() then ends the process with the signal itself.
+ *
+ * @param arg Unused.
+ * @return NULL.
+ */
+void *statsSignalThread(void *arg);
+
+/**
+ * @brief Ends the process with the signal that stopped it, if any.
+ *
+ * Registered with atexit() before the other handlers so it runs after them;
+ * it restores the default action and raises the signal again, so a shell or
+ * scheduler sees the run killed by it rather than a success.
+ *
+ * @return void
+ */
+void exitBySignal();
+
+/**
+ * @brief Returns the trace ring of the calling thread.
+ *
+ * On first use takes a ring freed by an exited thread, or creates one and
+ * links it into the list of all rings with a compare-and-swap. Rings stay
+ * in that list for the dump at exit, so threads started per solve reuse a
+ * few rings instead of adding one each; nothing is created when tracing is
+ * off.
+ *
+ * @param name The thread name shown in the trace, NULL to keep the current one.
+ * @return The ring, NULL when tracing is off or it cannot be allocated.
+ */
+TraceRing *traceThread(const char *name);
+
+/**
+ * @brief Puts the trace ring of an exiting thread on the free list.
+ *
+ * Its spans stay in the ring and are dumped under the thread that reuses it.
+ *
+ * @param arg The TraceRing.
+ * @return void
+ */
+void traceRelease(void *arg);
+
+/**
+ * @brief Returns the start time of a span.
+ *
+ * @return The time in seconds, 0 when tracing is off.
+ */
+double traceBegin();
+
+/**
+ * @brief Records a span of the calling thread.
+ *
+ * Does nothing when tracing is off.
+ *
+ * @param name The span name, a string literal.
+ * @param start The value returned by traceBegin().
+ * @return void
+ */
+void traceEnd(const char *name, double start);
+
+/**
+ * @brief Writes every recorded span to the --trace file.
+ *
+ * Registered with atexit() by --trace; the file uses the Chrome trace event
+ * JSON format, which Perfetto and chrome://tracing load.
+ *
+ * @return void
+ */
+void writeTrace();
+
+/**
+ * @brief Opens the counter group of the calling thread.
+ *
+ * Opens cycles, instructions, cache misses and branch misses with
+ * perf_event_open(), user space only and disabled until a phase starts.
+ * Counters the kernel refuses are left out, so --perf degrades to whatever
+ * the machine allows.
+ *
+ * @return The group, NULL if it cannot be allocated.
+ */
+PerfGroup *perfOpen();
+
+/**
+ * @brief Closes the counter group of an exiting thread.
+ *
+ * @param arg The PerfGroup.
+ * @return void
+ */
+void perfClose(void *arg);
+
+/**
+ * @brief Starts the hardware counters of a phase on the calling thread.
+ *
+ * Enables the group of the thread, opening it on first use. Phases of one
+ * thread do not nest.
+ *
+ * @param sample Where the group is stored.
+ * @return void
+ */
+void perfBegin(PerfSample *sample);
+
+/**
+ * @brief Stops the counters of a phase and reads what it counted.
+ *
+ * Disables the group and reads it at once. The counts are the difference
+ * from the previous read, scaled up by time enabled over time running when
+ * the PMU multiplexed the group with other events.
+ *
+ * @param sample The counters started by perfBegin().
+ * @param counts Where the counts are stored, -1 for unavailable counters.
+ * @return 1 if the counts were scaled, 0 otherwise.
+ */
+int perfStop(PerfSample *sample, long long counts[]);
+
+/**
+ * @brief Stops the counters a helper thread ran for a phase and adds them to its totals.
+ *
+ * Used by the pool threads of a parallel search; the run and its nodes are
+ * counted by perfEnd() on the thread that started the phase.
+ *
+ * @param phase The PerfPhase measured.
+ * @param sample The counters started by perfBegin().
+ * @return void
+ */
+void perfMerge(int phase, PerfSample *sample);
+
+/**
+ * @brief Stops the counters of a phase and adds them to its totals.
+ *
+ * @param phase The PerfPhase measured.
+ * @param sample The counters started by perfBegin().
+ * @param nodes The search nodes or propagation passes of the phase.
+ * @return void
+ */
+void perfEnd(int phase, PerfSample *sample, long nodes);
+
+/**
+ * @brief Prints the counter totals with IPC and misses per node.
+ *
+ * Registered with atexit() by --perf; prints to stderr.
+ *
+ * @return void
+ */
+void printPerf();
+
+/**
+ * @brief Computes a hash of a Latin square.
+ *
+ * @param sudoku The 2D array representing the Latin square.
+ * @param size The size of the square.
+ * @return The FNV-1a hash of the cell values.
+ */
+uint32_t hashLatinSquare(int sudoku[][N], int size);
+
+/**
+ * @brief The main function to run the game.
+ *
+ * Left out when LATINSQUARE_NO_MAIN is defined, so other programs such as
+ * the benchmark can include this file.
+ *
+ * Usage: latinsquare <file> [--script] [--replay <log> [--seek <move>]]
+ *                   [--server <port|unix:path> [--metrics <port>]]
+ *        latinsquare <file> --count | --estimate [--time <ms>] [--nodes <n>] [--threads <n>]
+ *        latinsquare <file> --portfolio [--time <ms>] [--nodes <n>] [--seed <n>]
+ *        latinsquare --http <port> [--threads <n>]
+ *        latinsquare --engine [--threads <n>]
+ *
+ * Every form also takes --stats [table|json] to print the solver statistics
+ * at exit, --trace <file> to write a Chrome trace of the run and --perf to
+ * print hardware counters of the solve and verify phases.
+ * 
+ * @param argc The number of command-line arguments.
+ * @param argv The command-line arguments.
+ * @return void
+ */
+#ifndef LATINSQUARE_NO_MAIN
+void main(int argc, char *argv[]){
+    static Game game;
+    char *file = NULL;
+    char *replay = NULL;
+    char *server = NULL;
+    char *metricsPort = NULL;
+    int count = 0;
+    int portfolio = 0;
+    uint64_t seed = RESTART_SEED;
+    SolveBudget budget = {0};
+    char *http = NULL;
+    int engine = 0;
+    long seek = -1;
+    for(int k = 1; k < argc; k++){
+        if(strcmp(argv[k], "--replay") == 0 && k+1 < argc){
+            replay = argv[++k];
+        }
+        else if(strcmp(argv[k], "--seek") == 0 && k+1 < argc){
+            seek = atol(argv[++k]);
+        }
+        else if(strcmp(argv[k], "--server") == 0 && k+1 < argc){
+            server = argv[++k];
+        }
+        else if(strcmp(argv[k], "--count") == 0 || strcmp(argv[k], "--estimate") == 0){
+            count = strcmp(argv[k], "--count") == 0 ? 1 : 2;
+        }
+        else if(strcmp(argv[k], "--time") == 0 && k+1 < argc){
+            budget.seconds = atof(argv[++k]) / 1000;
+        }
+        else if(strcmp(argv[k], "--nodes") == 0 && k+1 < argc){
+            budget.nodes = atol(argv[++k]);
+        }
+        else if(strcmp(argv[k], "--portfolio") == 0){
+            portfolio = 1;
+        }
+        else if(strcmp(argv[k], "--seed") == 0 && k+1 < argc){
+            seed = strtoull(argv[++k], NULL, 0);
+        }
+        else if(strcmp(argv[k], "--threads") == 0 && k+1 < argc){
+            solveThreads = atoi(argv[++k]);
+        }
+        else if(strcmp(argv[k], "--metrics") == 0 && k+1 < argc){
+            metricsPort = argv[++k];
+        }
+        else if(strcmp(argv[k], "--http") == 0 && k+1 < argc){
+            http = argv[++k];
+        }
+        else if(strcmp(argv[k], "--engine") == 0){
+            engine = 1;
+        }
+        else if(strcmp(argv[k], "--script") == 0){
+            game.quiet = 1;
+        }
+        else if(strcmp(argv[k], "--perf") == 0){
+            perfEnabled = 1;
+        }
+        else if(strcmp(argv[k], "--trace") == 0 && k+1 < argc){
+            traceFile = argv[++k];
+        }
+        else if(strcmp(argv[k], "--stats") == 0){
+            statsFormat = STATS_TABLE;
+            if(k+1 < argc && (strcmp(argv[k+1], "json") == 0 || strcmp(argv[k+1], "table") == 0)){
+                statsFormat = strcmp(argv[++k], "json") == 0 ? STATS_JSON : STATS_TABLE;
+            }
+        }
+        else if(argv[k][0] != '-' && file == NULL){
+            file = argv[k];
+        }
+        else{
+            printf("Unknown argument %s\n", argv[k]);
+            return;
+        }
+    }
+    if(metricsPort != NULL && server == NULL){
+        printf("--metrics needs --server\n");
+        return;
+    }
+    if(statsFormat != STATS_OFF || traceFile != NULL || perfEnabled){
+        sigset_t signals;
+        pthread_t thread;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, NULL);
+        atexit(exitBySignal);
+        if(pthread_create(&thread, NULL, statsSignalThread, NULL) == 0){
+            pthread_detach(thread);
+        }
+    }
+    if(statsFormat != STATS_OFF){
+        statsStart = wallSeconds();
+        atexit(printSolverStats);
+    }
+    if(traceFile != NULL){
+        pthread_key_create(&traceKey, traceRelease);
+        traceThread("main");
+        atexit(writeTrace);
+    }
+    if(perfEnabled){
+        pthread_key_create(&perfKey, perfClose);
+        atexit(printPerf);
+    }
+    if(http != NULL){
+        runHttpServer(http);
+        return;
+    }
+    if(engine){
+        runEngine();
+        return;
+    }
+    if(file == NULL){
+        printf("Missing arguments\n");
+        return;    
+    }
+    double start = traceBegin();
+    readLatinSquare(file, game.sudoku, &game.size);
+    traceEnd("load", start);
+    if(game.size == 0){
+        return;
+    }
+    if(portfolio){
+        runPortfolio(game.sudoku, game.size, &budget, seed);
+        return;
+    }
+    if(count){
+        budget.threads = solveThreads;
+        countLatinSquare(game.sudoku, game.size, count == 2, &budget);
+        return;
+    }
+    if(replay != NULL){
+        start = traceBegin();
+        int status = replayMoveLog(replay, game.sudoku, game.size, seek);
+        traceEnd("replay", start);
+        exit(status);
+    }
+    game.file = file;
+    if(server != NULL){
+        initCandidates(&game);
+        runServer(server, &game, metricsPort);
+        return;
+    }
+    if(game.quiet){
+        setvbuf(stdin, NULL, _IOFBF, SCRIPT_BUFFER);
+    }
+    long recovered = openMoveLog(&game.log, file, game.sudoku, game.size);
+    if(recovered > 0){
+        printf("Recovered %ld moves from the move log\n", recovered);
+    }
+    initCandidates(&game);
+    startBackgroundSolve(&game);
+    play(&game);
+}
+#endif
+
+void readLatinSquare(char file[], int sudoku[][N], int *n){
+
+    FILE *fp;
+    fp = fopen(file, "r");
+    if(fp == NULL){
+        printf("error, cannot open file...");
+    }
+
+    fscanf(fp, "%d", n);
+    if(*n>N){
+        printf("wrong n...");
+        return;
+    }
+
+    for(int i = 0; i < *n; i++){
+        for(int j = 0; j < *n; j++){
+        fscanf(fp, "%d", &sudoku[i][j]);
+        if(abs(sudoku[i][j])>*n){
+            printf("File contains invalid values!\n");
+            *n = 0;
+            return;
+        }
+        }
+    }
+
+    if(!feof(fp)){
+        printf("File contains more data than expected!\n");
+        *n = 0;
+        return;
+    }
+
+    fclose(fp);
+
+}
+
+void displayLatinSquare(int sudoku[][N], int size){
+
+    char buf[RENDER_BYTES(N)];
+    fwrite(buf, 1, renderLatinSquare(sudoku, size, buf), stdout);
+
+}
+
+int renderLatinSquare(int sudoku[][N], int size, char buf[]){
+
+    int len = 0;
+    for(int i = 0; i <= size; i++){
+        for(int j = 0; j < size; j++){
+            memcpy(buf + len, "+-----", 6);
+            len += 6;
+        }
+        memcpy(buf + len, "+\n", 2);
+        len += 2;
+        if(i == size){
+            break;
+        }
+        for(int j = 0; j < size; j++){
+            if(sudoku[i][j] < 0){
+                len += sprintf(buf + len, size < 10 ? "| (%d) " : "|(%2d) ", -sudoku[i][j]);
+            }
+            else{
+                len += sprintf(buf + len, size < 10 ? "|  %d  " : "| %2d  ", sudoku[i][j]);
+            }
+        }
+        memcpy(buf + len, "|\n", 2);
+        len += 2;
+    }
+    buf[len] = '\0';
+
+    return len;
+
+}
+
+void gamePrintf(Game *game, const char *format, ...){
+
+    va_list args;
+    va_start(args, format);
+    if(game->out == NULL){
+        vprintf(format, args);
+    }
+    else if(game->outLen < game->outCap){
+        int len = vsnprintf(game->out + game->outLen, game->outCap - game->outLen, format, args);
+        game->outLen = game->outLen + len < game->outCap ? game->outLen + len : game->outCap;
+    }
+    va_end(args);
+
+}
+
+void gameRender(Game *game){
+
+    if(game->out == NULL){
+        displayLatinSquare(game->sudoku, game->size);
+    }
+    else if(game->outCap - game->outLen >= RENDER_BYTES(game->size)){
+        game->outLen += renderLatinSquare(game->sudoku, game->size, game->out + game->outLen);
+    }
+
+}
+
+void writeLatinSquare(int sudoku[][N], int size, char file[]){
+
+    double start = traceBegin();
+    char filename[100] = "-out";
+    strcat(filename, file);
+
+    FILE *fp;
+    fp = fopen(filename, "w");
+
+    printf("\nSaving to out-lsq1.txt...\n");
+
+    fprintf(fp, "%d\n", size);
+    for(int i=0; i<size; i++){
+        for(int j = 0; j<size; j++){
+            fprintf(fp, "%d ", (sudoku[i][j]));
+        }
+       fprintf(fp, "\n");
+    }
+
+    fclose(fp);
+
+    printf("Done\n");
+    traceEnd("write", start);
+
+}
+
+void play(Game *game){
+    char line[LINE_LEN];
+
+    playStart(game);
+    while(game->state == PLAY_INPUT){
+
+        if(fgets(line, sizeof(line), stdin) == NULL){
+            printf("\nEnd of input, progress is kept in the move log\n");
+            closeMoveLog(&game->log, game->file, 0);
+            return;
+        }
+        if(strchr(line, '\n') == NULL){
+            int c;
+            while((c = getchar()) != '\n' && c != EOF) {};
+        }
+
+        playFeed(game, line);
+
+    }
+
+    return;
+
+}
+
+void playStart(Game *game){
+
+    game->state = PLAY_INPUT;
+    playPrompt(game);
+
+}
+
+int playFeed(Game *game, char line[]){
+
+    if(game->state != PLAY_INPUT){
+        return game->state;
+    }
+
+    double start = wallSeconds();
+    int type = commandType(line);
+    int playing = playCommand(game, line);
+    int win = checkGame(game->sudoku, game->size);
+    if(win == 0 && playing == 1){
+        playPrompt(game);
+        recordLatency(type, start);
+        return game->state;
+    }
+
+    if(win == 1){
+        gamePrintf(game, "\nGame completed!!!\n");
+        if(!game->quiet){
+            gameRender(game);
+        }
+    }
+    if(game->file != NULL){
+        writeLatinSquare(game->sudoku, game->size, game->file);
+        closeMoveLog(&game->log, game->file, 1);
+    }
+    else{
+        gamePrintf(game, "\nSession ended\n");
+    }
+    game->state = PLAY_OVER;
+    recordLatency(type, start);
+
+    return game->state;
+
+}
+
+void playPrompt(Game *game){
+
+    if(game->quiet){
+        return;
+    }
+    gameRender(game);
+    if(game->out == NULL){
+        printCommands();
+    }
+    else{
+        gamePrintf(game, ">");
+    }
+
+}
+
+int playCommand(Game *game, char line[]){
+    int moves[BATCH_MAX][4]; // i, j, val and the previous value of the cell
+    int count = 0;
+    char *next = line;
+
+    int i=0, j=0;
+    if(strncmp(line, "latency", 7) == 0){
+        printLatencies(game);
+        return 1;
+    }
+    if(strncmp(line, "hint", 4) == 0){
+        int val = 0;
+        int kind = hintCell(game, &i, &j, &val);
+        if(kind == HINT_FORCED){
+            gamePrintf(game, "\nHint: cell (%d,%d) must be %d\n", i+1, j+1, val);
+        }
+        else if(kind == HINT_SOLVED){
+            gamePrintf(game, "\nHint: cell (%d,%d) can be %d\n", i+1, j+1, val);
+        }
+        else if(kind == HINT_GUESS){
+            gamePrintf(game, "\nHint: try %d at cell (%d,%d), the search ran out of time before proving it\n", val, i+1, j+1);
+        }
+        else if(kind == HINT_DEAD){
+            gamePrintf(game, "\nNo hint, the square cannot be completed from here!\n");
+        }
+        else{
+            gamePrintf(game, "\nNo forced cell, every empty cell has several candidates!\n");
+        }
+        return 1;
+    }
+    if(line[0] == '?'){
+        if(sscanf(line + 1, "%d,%d", &i, &j) != 2){
+            gamePrintf(game, "Error: wrong format of command!\n");
+        }
+        else if(i<1 || i>game->size || j<1 || j>game->size){
+            gamePrintf(game, "\nError: i,j are outside the allowed range [1..%d]!\n", game->size);
+        }
+        else{
+            printCandidates(game, i, j);
+        }
+        return 1;
+    }
+
+    while(next != NULL){
+        int i=0, j=0, val=0;
+        if(count == BATCH_MAX || sscanf(next, "%d,%d=%d", &i, &j, &val) != 3){
+            gamePrintf(game, "Error: wrong format of command!\n");
+            return 1;
+        }
+        moves[count][0] = i;
+        moves[count][1] = j;
+        moves[count][2] = val;
+        count++;
+        next = strchr(next, ';');
+        if(next != NULL){
+            next++;
+        }
+    }
+
+    for(int k = 0; k < count; k++){
+        int i = moves[k][0], j = moves[k][1], val = moves[k][2];
+        int ok = checkInput(i, j, val, game->size);
+        if(ok == 0){
+            gamePrintf(game, "\nError: i,j or val are outside the allowed range [1..%d]!\n", game->size);
+        }
+        else if(i==0 && j==0 && val==0){
+            if(count == 1){
+                return 0;
+            }
+            gamePrintf(game, "\nError: save command cannot be combined with moves!\n");
+            ok = 0;
+        }
+        else{
+            int err = checkMove(game->sudoku, game->size, val, i, j);
+            if(err != MOVE_OK){
+                gamePrintf(game, "\n%s\n", moveErrorMessage(err));
+                ok = 0;
+            }
+        }
+        if(ok == 0){
+            while(k-- > 0){
+                game->sudoku[moves[k][0]-1][moves[k][1]-1] = moves[k][3];
+            }
+            if(count > 1){
+                gamePrintf(game, "Error: no moves of the line were applied!\n");
+            }
+            return 1;
+        }
+        moves[k][3] = game->sudoku[i-1][j-1];
+        game->sudoku[i-1][j-1] = val;
+    }
+
+    atomic_fetch_add_explicit(&metrics.moves, count, memory_order_relaxed);
+    // Validation applied the whole line, replay it move by move so a log
+    // snapshot falling inside the line holds the board right after its move
+    for(int k = count; k-- > 0;){
+        game->sudoku[moves[k][0]-1][moves[k][1]-1] = moves[k][3];
+    }
+    for(int k = 0; k < count; k++){
+        game->sudoku[moves[k][0]-1][moves[k][1]-1] = moves[k][2];
+        appendMove(&game->log, game->sudoku, game->size, moves[k][0], moves[k][1], moves[k][2]);
+        updateCandidates(game, moves[k][0]-1, moves[k][1]-1);
+        if(game->onMove != NULL){
+            game->onMove(game->owner, moves[k][0], moves[k][1], moves[k][2]);
+        }
+    }
+    if(count > 1){
+        gamePrintf(game, "\n%d moves applied!\n", count);
+    }
+    else if(moves[0][2]==0){
+        gamePrintf(game, "\nValue cleared!\n");
+    }
+    else{
+        gamePrintf(game, "\nValue inserted!\n");
+    }
+
+    if(atomic_load_explicit(&game->solveState, memory_order_acquire) == SOLVE_DONE){
+        for(int k = 0; k < count; k++){
+            int i = moves[k][0], j = moves[k][1], val = moves[k][2];
+            if(val != 0 && (game->solutions == 0 || (game->solutions == 1 && game->solution[i-1][j-1] != val))){
+                gamePrintf(game, "Warning: %d at (%d,%d) will lead to a dead end!\n", val, i, j);
+                return 1;
+            }
+        }
+    }
+
+    int inserted = 0;
+    for(int k = 0; k < count; k++){
+        inserted |= moves[k][2] != 0;
+    }
+    if(inserted){
+        Solver solver;
+        PerfSample sample;
+        double start = traceBegin();
+        perfBegin(&sample);
+        int dead = !initSolver(&solver, game->sudoku, game->size)
+            || propagateSolver(&solver, wallSeconds() + DEADEND_BUDGET) == PROPAGATE_DEAD;
+        perfEnd(PERF_VERIFY, &sample, solver.propagations);
+        traceEnd("propagate", start);
+        if(dead){
+            gamePrintf(game, "Warning: the square cannot be completed anymore!\n");
+        }
+        mergeSolverStats(&solver);
+    }
+
+    return 1;
+
+}
+
+int checkGame(int sudoku[][N], int size){
+
+    for(int i = 0; i < size; i++){
+        int arr[N] = {0};
+        for(int j = 0; j < size; j++){
+            if(abs(sudoku[i][j]) == 0){
+                return 0;
+            }
+            else if(arr[abs(sudoku[i][j])-1] ==  0){
+                arr[abs(sudoku[i][j])-1] == 1;
+            }
+            else{
+                return 0;
+            }
+        }
+    }
+
+    for(int j = 0; j < size; j++){
+        int arr[N] = {0};
+        for(int i = 0; i < size; i++){
+            if(abs(sudoku[i][j]) == 0){
+                return 0;
+            }
+            else if(arr[abs(sudoku[i][j])-1] ==  0){
+                arr[abs(sudoku[i][j])-1] == 1;
+            }
+            else{
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+
+}
+
+int validMove(int sudoku[][N], int size, int val, int i, int j){
+
+    int err = checkMove(sudoku, size, val, i, j);
+    if(err != MOVE_OK){
+        printf("\n%s\n", moveErrorMessage(err));
+        return 0;
+    }
+    return 1;
+
+}
+
+char *moveErrorMessage(int err){
+
+    switch(err){
+        case MOVE_OK:
+            return "";
+        case MOVE_OCCUPIED:
+            return "Error: cell is already occupied!";
+        case MOVE_ILLEGAL_CLEAR:
+            return "Error: illegal to clear cell!";
+        default:
+            return "Error: Illegal value insertion!";
+    }
+
+}
+
+int checkMove(int sudoku[][N], int size, int val, int i, int j){
+
+    if(i==0 && j==0 && val==0){
+        return MOVE_OK;
+    }
+    if(i<1 || i>size || j<1 || j>size || val<0 || val>size){
+        return MOVE_RANGE;
+    }
+    if(sudoku[i-1][j-1] != 0 && val!=0){
+        return MOVE_OCCUPIED;
+    }
+    else if(sudoku[i-1][j-1] == 0 && val==0){
+        return MOVE_ILLEGAL_CLEAR;
+    }
+    else if(sudoku[i-1][j-1] < 0 && val==0){
+        return MOVE_ILLEGAL_CLEAR;
+    }
+    
+    if(val==0){
+        return MOVE_OK;
+    }
+
+    for(int col = 0; col < N; col++){
+        if(abs(sudoku[i-1][col]) == val){
+            return MOVE_ILLEGAL_VALUE;
+        }
+    }
+
+    for(int row = 0; row < N; row++){
+        if(abs(sudoku[row][j-1]) == val){
+            return MOVE_ILLEGAL_VALUE;
+        }
+    }
+
+    return MOVE_OK;
+
+}
+
+void initCandidates(Game *game){
+
+    for(int k = 0; k < game->size; k++){
+        game->rowMask[k] = 0;
+        game->colMask[k] = 0;
+    }
+    for(int i = 0; i < game->size; i++){
+        for(int j = 0; j < game->size; j++){
+            if(game->sudoku[i][j] != 0){
+                game->rowMask[i] |= 1u << (abs(game->sudoku[i][j])-1);
+                game->colMask[j] |= 1u << (abs(game->sudoku[i][j])-1);
+            }
+        }
+    }
+    unsigned int all = (1u << game->size) - 1;
+    for(int i = 0; i < game->size; i++){
+        for(int j = 0; j < game->size; j++){
+            game->cand[i][j] = game->sudoku[i][j] != 0 ? 0 : all & ~(game->rowMask[i] | game->colMask[j]);
+        }
+    }
+
+}
+
+void updateCandidates(Game *game, int row, int col){
+
+    game->rowMask[row] = 0;
+    game->colMask[col] = 0;
+    for(int k = 0; k < game->size; k++){
+        if(game->sudoku[row][k] != 0){
+            game->rowMask[row] |= 1u << (abs(game->sudoku[row][k])-1);
+        }
+        if(game->sudoku[k][col] != 0){
+            game->colMask[col] |= 1u << (abs(game->sudoku[k][col])-1);
+        }
+    }
+
+    unsigned int all = (1u << game->size) - 1;
+    for(int k = 0; k < game->size; k++){
+        game->cand[row][k] = game->sudoku[row][k] != 0 ? 0 : all & ~(game->rowMask[row] | game->colMask[k]);
+        game->cand[k][col] = game->sudoku[k][col] != 0 ? 0 : all & ~(game->rowMask[k] | game->colMask[col]);
+    }
+
+}
+
+int commandType(char line[]){
+
+    if(strncmp(line, "hint", 4) == 0){
+        return COMMAND_HINT;
+    }
+    if(line[0] == '?'){
+        return COMMAND_QUERY;
+    }
+    int i, j, val, len;
+    int type = COMMAND_OTHER;
+    for(char *next = line; sscanf(next, "%d,%d=%d%n", &i, &j, &val, &len) == 3; next += len + 1){
+        if(i == 0 && j == 0 && val == 0){
+            return COMMAND_SAVE;
+        }
+        if(val != 0){
+            type = COMMAND_INSERT;
+        }
+        else if(type == COMMAND_OTHER){
+            type = COMMAND_CLEAR;
+        }
+        if(next[len] != ';'){
+            break;
+        }
+    }
+
+    return type;
+
+}
+
+void recordLatency(int type, double start){
+
+    if(type == COMMAND_OTHER){
+        return;
+    }
+    long ns = (wallSeconds() - start) * 1e9;
+    ns = ns > 0 ? ns : 0;
+
+    LatencyHistogram *histogram = &latencies[type];
+    atomic_fetch_add_explicit(&histogram->buckets[latencyBucket(ns)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum, ns, memory_order_relaxed);
+    long max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    while(ns > max && !atomic_compare_exchange_weak_explicit(&histogram->max, &max, ns,
+        memory_order_relaxed, memory_order_relaxed)){
+        // max now holds the current maximum, try again
+    }
+
+}
+
+int latencyBucket(unsigned long ns){
+
+    int msb = 63 - __builtin_clzl(ns | 1);
+    if(msb < LATENCY_SUB_BITS){
+        return ns;
+    }
+    int shift = msb - LATENCY_SUB_BITS;
+
+    return ((shift + 1) << LATENCY_SUB_BITS) + (int)(ns >> shift) - (1 << LATENCY_SUB_BITS);
+
+}
+
+long latencyPercentile(LatencyHistogram *histogram, double percentile){
+
+    long count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+    long rank = (long)(percentile / 100 * count + 0.5);
+    rank = rank < 1 ? 1 : rank;
+    long seen = 0;
+    for(int bucket = 0; bucket < LATENCY_BUCKETS; bucket++){
+        seen += atomic_load_explicit(&histogram->buckets[bucket], memory_order_relaxed);
+        if(seen >= rank){
+            if(bucket < (1 << LATENCY_SUB_BITS)){
+                return bucket;
+            }
+            int shift = (bucket >> LATENCY_SUB_BITS) - 1;
+            long low = (long)((1 << LATENCY_SUB_BITS) + (bucket & ((1 << LATENCY_SUB_BITS) - 1))) << shift;
+            long high = low + (1L << shift) - 1;
+            long max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+            return high < max ? high : max;
+        }
+    }
+
+    return atomic_load_explicit(&histogram->max, memory_order_relaxed);
+
+}
+
+void printLatencies(Game *game){
+
+    char *names[COMMAND_TYPES] = {"insert", "clear", "hint", "query", "save"};
+    gamePrintf(game, "\n%-7s %8s %9s %9s %9s %9s %9s\n", "command", "count", "p50 us", "p90 us", "p99 us", "p99.9 us", "max us");
+    for(int type = 0; type < COMMAND_TYPES; type++){
+        LatencyHistogram *histogram = &latencies[type];
+        long count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+        if(count == 0){
+            gamePrintf(game, "%-7s %8d %9s %9s %9s %9s %9s\n", names[type], 0, "-", "-", "-", "-", "-");
+            continue;
+        }
+        gamePrintf(game, "%-7s %8ld %9.1f %9.1f %9.1f %9.1f %9.1f\n", names[type], count,
+            latencyPercentile(histogram, 50) / 1e3, latencyPercentile(histogram, 90) / 1e3,
+            latencyPercentile(histogram, 99) / 1e3, latencyPercentile(histogram, 99.9) / 1e3,
+            atomic_load_explicit(&histogram->max, memory_order_relaxed) / 1e3);
+    }
+
+}
+
+void printCandidates(Game *game, int i, int j){
+
+    if(game->sudoku[i-1][j-1] != 0){
+        gamePrintf(game, "\nCell (%d,%d) is already filled with %d\n", i, j, abs(game->sudoku[i-1][j-1]));
+        return;
+    }
+
+    gamePrintf(game, "\nCandidates of cell (%d,%d):", i, j);
+    for(int v = 1; v <= game->size; v++){
+        if(game->cand[i-1][j-1] & (1u << (v-1))){
+            gamePrintf(game, " %d", v);
+        }
+    }
+    gamePrintf(game, "\n");
+
+}
+
+int findForcedCell(Game *game, int *row, int *col){
+
+    for(int i = 0; i < game->size; i++){
+        for(int j = 0; j < game->size; j++){
+            if(game->cand[i][j] != 0 && (game->cand[i][j] & (game->cand[i][j]-1)) == 0){
+                *row = i;
+                *col = j;
+                return __builtin_ctz(game->cand[i][j]) + 1;
+            }
+        }
+    }
+
+    for(int k = 0; k < game->size; k++){
+        for(int v = 0; v < game->size; v++){
+            unsigned int bit = 1u << v;
+            int inRow = 0, inCol = 0, rowAt = 0, colAt = 0;
+            for(int x = 0; x < game->size; x++){
+                if(game->cand[k][x] & bit){
+                    inRow++;
+                    rowAt = x;
+                }
+                if(game->cand[x][k] & bit){
+                    inCol++;
+                    colAt = x;
+                }
+            }
+            if(inRow == 1 && !(game->rowMask[k] & bit)){
+                *row = k;
+                *col = rowAt;
+                return v + 1;
+            }
+            if(inCol == 1 && !(game->colMask[k] & bit)){
+                *row = colAt;
+                *col = k;
+                return v + 1;
+            }
+        }
+    }
+
+    return 0;
+
+}
+
+long solveLatinSquare(int sudoku[][N], int size, int solution[][N], long limit, SolveBudget *budget, int *stopped){
+
+    if(stopped != NULL){
+        *stopped = STOP_NONE;
+    }
+    Solver *solver = malloc(sizeof(Solver));
+    if(solver == NULL){
+        return 0;
+    }
+    if(!initSolver(solver, sudoku, size)){
+        free(solver);
+        return 0;
+    }
+    solver->limit = limit;
+    applyBudget(solver, budget);
+
+    PerfSample sample;
+    double start = traceBegin();
+    perfBegin(&sample);
+    atomic_fetch_add_explicit(&metrics.solves, 1, memory_order_relaxed);
+    searchParallel(solver, budget != NULL ? budget->threads : 1);
+    perfEnd(PERF_SOLVE, &sample, solver->nodes);
+    traceEnd("search", start);
+    mergeSolverStats(solver);
+
+    long solutions = solver->solutions;
+    if(solutions > 0){
+        memcpy(solution, solver->solution, sizeof(solver->solution));
+    }
+    else if(solver->stopped){
+        memcpy(solution, solver->deepest, sizeof(solver->deepest));
+    }
+    if(stopped != NULL){
+        *stopped = solver->stopped;
+    }
+    free(solver);
+
+    return solutions;
+
+}
+
+void applyBudget(Solver *solver, SolveBudget *budget){
+
+    if(budget == NULL){
+        return;
+    }
+    solver->deadline = budget->seconds > 0 ? wallSeconds() + budget->seconds : 0;
+    solver->nodeLimit = budget->nodes;
+    solver->token = budget->token;
+    if(budget->hangup > 0){
+        budget->checked = wallSeconds();
+        solver->progress = watchHangup;
+        solver->owner = budget;
+    }
+
+}
+
+int hintCell(Game *game, int *row, int *col, int *val){
+
+    *val = findForcedCell(game, row, col);
+    if(*val != 0){
+        return HINT_FORCED;
+    }
+
+    Solver solver;
+    unsigned int cand;
+    if(!initSolver(&solver, game->sudoku, game->size) || pickCell(&solver, row, col, &cand) == 0){
+        return HINT_DEAD;
+    }
+    if(*row < 0){
+        return HINT_NONE;
+    }
+    if(atomic_load_explicit(&game->solveState, memory_order_acquire) == SOLVE_DONE && game->solutions > 0){
+        int inside = 1;
+        for(int i = 0; i < game->size && inside; i++){
+            for(int j = 0; j < game->size; j++){
+                if(game->sudoku[i][j] != 0 && abs(game->sudoku[i][j]) != game->solution[i][j]){
+                    inside = 0;
+                    break;
+                }
+            }
+        }
+        if(inside){
+            *val = game->solution[*row][*col];
+            return HINT_SOLVED;
+        }
+    }
+    if(propagateSolver(&solver, wallSeconds() + DEADEND_BUDGET) == PROPAGATE_DEAD){
+        return HINT_DEAD;
+    }
+    int result[N][N];
+    int stopped;
+    SolveBudget budget = {.seconds = game->out != NULL ? HINT_SERVER_SECONDS : HINT_SECONDS};
+    if(solveLatinSquare(game->sudoku, game->size, result, 1, &budget, &stopped) > 0){
+        *val = result[*row][*col];
+        return HINT_SOLVED;
+    }
+    if(stopped == STOP_NONE){
+        return HINT_DEAD;
+    }
+    *val = result[*row][*col];
+
+    return *val != 0 ? HINT_GUESS : HINT_NONE;
+
+}
+
+int initSolver(Solver *solver, int sudoku[][N], int size){
+
+    memset(solver, 0, sizeof(Solver));
+    solver->size = size;
+    for(int i = 0; i < size; i++){
+        for(int j = 0; j < size; j++){
+            int val = abs(sudoku[i][j]);
+            solver->grid[i][j] = val;
+            if(val != 0){
+                if((solver->rowUsed[i] | solver->colUsed[j]) & (1u << (val-1))){
+                    return 0;
+                }
+                solver->rowUsed[i] |= 1u << (val-1);
+                solver->colUsed[j] |= 1u << (val-1);
+            }
+        }
+    }
+
+    return 1;
+
+}
+
+void placeValue(Solver *solver, int row, int col, unsigned int bit){
+
+    solver->grid[row][col] = __builtin_ctz(bit) + 1;
+    solver->rowUsed[row] |= bit;
+    solver->colUsed[col] |= bit;
+
+}
+
+int propagateSolver(Solver *solver, double deadline){
+
+    int size = solver->size;
+    unsigned int all = (1u << size) - 1;
+    int changed = 1;
+
+    while(changed){
+        if(deadline > 0 && wallSeconds() > deadline){
+            return PROPAGATE_TIMEOUT;
+        }
+        solver->propagations++;
+        changed = 0;
+        int empty = 0;
+
+        for(int i = 0; i < size; i++){
+            for(int j = 0; j < size; j++){
+                if(solver->grid[i][j] != 0){
+                    continue;
+                }
+                unsigned int cand = all & ~(solver->rowUsed[i] | solver->colUsed[j]);
+                if(cand == 0){
+                    return PROPAGATE_DEAD;
+                }
+                if((cand & (cand-1)) == 0){
+                    placeValue(solver, i, j, cand);
+                    solver->nakedSingles++;
+                    changed = 1;
+                }
+                else{
+                    empty++;
+                }
+            }
+        }
+        if(empty == 0){
+            return PROPAGATE_SOLVED;
+        }
+
+        for(int k = 0; k < size; k++){
+            unsigned int rowMissing = all & ~solver->rowUsed[k];
+            unsigned int colMissing = all & ~solver->colUsed[k];
+            unsigned int rowOnce = 0, rowTwice = 0, colOnce = 0, colTwice = 0;
+            for(int x = 0; x < size; x++){
+                if(solver->grid[k][x] == 0){
+                    unsigned int cand = all & ~(solver->rowUsed[k] | solver->colUsed[x]);
+                    rowTwice |= rowOnce & cand;
+                    rowOnce |= cand;
+                }
+                if(solver->grid[x][k] == 0){
+                    unsigned int cand = all & ~(solver->rowUsed[x] | solver->colUsed[k]);
+                    colTwice |= colOnce & cand;
+                    colOnce |= cand;
+                }
+            }
+            if((rowMissing & ~rowOnce) != 0 || (colMissing & ~colOnce) != 0){
+                return PROPAGATE_DEAD;
+            }
+            unsigned int rowSingles = rowOnce & ~rowTwice;
+            unsigned int colSingles = colOnce & ~colTwice;
+            for(int x = 0; x < size && (rowSingles | colSingles) != 0; x++){
+                if(solver->grid[k][x] == 0){
+                    unsigned int hit = rowSingles & ~(solver->rowUsed[k] | solver->colUsed[x]);
+                    if(hit != 0){
+                        placeValue(solver, k, x, hit & -hit);
+                        rowSingles &= ~hit;
+                        solver->hiddenSingles++;
+                        changed = 1;
+                    }
+                }
+                if(solver->grid[x][k] == 0){
+                    unsigned int hit = colSingles & ~(solver->rowUsed[x] | solver->colUsed[k]);
+                    if(hit != 0){
+                        placeValue(solver, x, k, hit & -hit);
+                        colSingles &= ~hit;
+                        solver->hiddenSingles++;
+                        changed = 1;
+                    }
+                }
+            }
+        }
+    }
+
+    return PROPAGATE_STUCK;
+
+}
+
+void searchLatinSquare(Solver *solver){
+
+    if(countNode(solver)){
+        return;
+    }
+    if(solver->depth > solver->peakDepth || solver->nodes == 1){
+        solver->peakDepth = solver->depth;
+        memcpy(solver->deepest, solver->grid, sizeof(solver->grid));
+    }
+    int bestRow, bestCol;
+    unsigned int bestCand;
+    int bestCount = pickCell(solver, &bestRow, &bestCol, &bestCand);
+
+    if(bestRow < 0){
+        if(solver->solutions == 0){
+            memcpy(solver->solution, solver->grid, sizeof(solver->grid));
+        }
+        solver->solutions++;
+        return;
+    }
+
+    if(bestCount == 1){
+        solver->forcedChoices++;
+    }
+    solver->depth++;
+    while(bestCand != 0 && solver->solutions < solver->limit && !solver->stopped){
+        unsigned int bit = bestCand & -bestCand;
+        long found = solver->solutions;
+        bestCand &= bestCand - 1;
+        placeValue(solver, bestRow, bestCol, bit);
+        searchLatinSquare(solver);
+        solver->rowUsed[bestRow] &= ~bit;
+        solver->colUsed[bestCol] &= ~bit;
+        solver->backtracks += solver->solutions == found;
+    }
+    solver->depth--;
+    solver->grid[bestRow][bestCol] = 0;
+
+}
+
+int countNode(Solver *solver){
+
+    if(++solver->nodes % CHECK_INTERVAL == 0){
+        int reason = solver->token != NULL ? atomic_load_explicit(&solver->token->reason, memory_order_relaxed) : STOP_NONE;
+        if(reason != STOP_NONE){
+            solver->stopped = reason;
+        }
+        else if(solver->deadline > 0 && wallSeconds() > solver->deadline){
+            solver->stopped = STOP_TIMEOUT;
+        }
+        if(solver->progress != NULL){
+            solver->progress(solver);
+        }
+    }
+    if(solver->nodeLimit > 0 && solver->nodes > solver->nodeLimit){
+        solver->stopped = STOP_NODES;
+    }
+
+    return solver->stopped;
+
+}
+
+void searchPropagating(Solver *solver){
+
+    if(countNode(solver)){
+        return;
+    }
+    int grid[N][N];
+    unsigned int rowUsed[N], colUsed[N];
+    memcpy(grid, solver->grid, sizeof(grid));
+    memcpy(rowUsed, solver->rowUsed, sizeof(rowUsed));
+    memcpy(colUsed, solver->colUsed, sizeof(colUsed));
+
+    int outcome = propagateSolver(solver, 0);
+    if(outcome == PROPAGATE_SOLVED){
+        if(solver->solutions == 0){
+            memcpy(solver->solution, solver->grid, sizeof(solver->grid));
+        }
+        solver->solutions++;
+    }
+    else if(outcome == PROPAGATE_STUCK){
+        int row, col;
+        unsigned int cand;
+        pickCell(solver, &row, &col, &cand);
+        if(++solver->depth > solver->peakDepth){
+            solver->peakDepth = solver->depth;
+        }
+        while(cand != 0 && solver->solutions < solver->limit && !solver->stopped){
+            unsigned int bit = cand & -cand;
+            long found = solver->solutions;
+            cand &= cand - 1;
+            placeValue(solver, row, col, bit);
+            searchPropagating(solver);
+            solver->grid[row][col] = 0;
+            solver->rowUsed[row] &= ~bit;
+            solver->colUsed[col] &= ~bit;
+            solver->backtracks += solver->solutions == found;
+        }
+        solver->depth--;
+    }
+
+    memcpy(solver->grid, grid, sizeof(grid));
+    memcpy(solver->rowUsed, rowUsed, sizeof(rowUsed));
+    memcpy(solver->colUsed, colUsed, sizeof(colUsed));
+
+}
+
+void solveLinks(Solver *solver){
+
+    int size = solver->size;
+    int columns = 3 * size * size;
+    unsigned int all = (1u << size) - 1;
+    DancingLinks links;
+    links.nodes = malloc((1 + columns + 3 * size * size * size) * sizeof(LinkNode));
+    links.sizes = calloc(1 + columns, sizeof(int));
+    links.chosen = malloc(size * size * sizeof(int));
+    if(links.nodes == NULL || links.sizes == NULL || links.chosen == NULL){
+        free(links.nodes);
+        free(links.sizes);
+        free(links.chosen);
+        solver->stopped = STOP_CANCELLED;
+        return;
+    }
+
+    LinkNode *nodes = links.nodes;
+    for(int h = 0; h <= columns; h++){
+        nodes[h].left = h == 0 ? columns : h - 1;
+        nodes[h].right = h == columns ? 0 : h + 1;
+        nodes[h].up = nodes[h].down = nodes[h].column = h;
+        nodes[h].row = -1;
+    }
+    links.count = columns + 1;
+    for(int i = 0; i < size; i++){
+        for(int j = 0; j < size; j++){
+            if(solver->grid[i][j] != 0){
+                continue;
+            }
+            for(unsigned int cand = all & ~(solver->rowUsed[i] | solver->colUsed[j]); cand != 0; cand &= cand - 1){
+                int v = __builtin_ctz(cand);
+                int headers[3] = {1 + i*size + j, 1 + size*size + i*size + v, 1 + 2*size*size + j*size + v};
+                int first = links.count;
+                for(int k = 0; k < 3; k++){
+                    int n = links.count++;
+                    int h = headers[k];
+                    nodes[n].column = h;
+                    nodes[n].row = (i*size + j)*size + v;
+                    nodes[n].up = nodes[h].up;
+                    nodes[n].down = h;
+                    nodes[nodes[h].up].down = n;
+                    nodes[h].up = n;
+                    nodes[n].left = k == 0 ? first + 2 : n - 1;
+                    nodes[n].right = k == 2 ? first : n + 1;
+                    links.sizes[h]++;
+                }
+            }
+        }
+    }
+    // Constraints the givens already meet have no candidates left, drop them
+    for(int h = 1; h <= columns; h++){
+        int k = (h - 1) % (size * size);
+        int a = k / size, b = k % size;
+        int met = h <= size*size ? solver->grid[a][b] != 0
+            : h <= 2*size*size ? (solver->rowUsed[a] >> b) & 1 : (solver->colUsed[a] >> b) & 1;
+        if(met){
+            nodes[nodes[h].left].right = nodes[h].right;
+            nodes[nodes[h].right].left = nodes[h].left;
+        }
+    }
+
+    searchLinks(&links, solver, 0);
+    free(links.nodes);
+    free(links.sizes);
+    free(links.chosen);
+
+}
+
+void searchLinks(DancingLinks *links, Solver *solver, int depth){
+
+    if(countNode(solver)){
+        return;
+    }
+    LinkNode *nodes = links->nodes;
+    int size = solver->size;
+    if(nodes[0].right == 0){
+        if(solver->solutions == 0){
+            memcpy(solver->solution, solver->grid, sizeof(solver->grid));
+            for(int k = 0; k < depth; k++){
+                int cand = links->chosen[k];
+                solver->solution[cand / size / size][cand / size % size] = cand % size + 1;
+            }
+        }
+        solver->solutions++;
+        return;
+    }
+
+    int best = nodes[0].right;
+    for(int h = nodes[best].right; h != 0 && links->sizes[best] > 1; h = nodes[h].right){
+        if(links->sizes[h] < links->sizes[best]){
+            best = h;
+        }
+    }
+    if(links->sizes[best] == 0){
+        return;
+    }
+    if(links->sizes[best] == 1){
+        solver->forcedChoices++;
+    }
+    if(depth + 1 > solver->peakDepth){
+        solver->peakDepth = depth + 1;
+    }
+
+    coverColumn(links, best);
+    for(int r = nodes[best].down; r != best && solver->solutions < solver->limit && !solver->stopped; r = nodes[r].down){
+        long found = solver->solutions;
+        links->chosen[depth] = nodes[r].row;
+        for(int j = nodes[r].right; j != r; j = nodes[j].right){
+            coverColumn(links, nodes[j].column);
+        }
+        searchLinks(links, solver, depth + 1);
+        for(int j = nodes[r].left; j != r; j = nodes[j].left){
+            uncoverColumn(links, nodes[j].column);
+        }
+        solver->backtracks += solver->solutions == found;
+    }
+    uncoverColumn(links, best);
+
+}
+
+void coverColumn(DancingLinks *links, int column){
+
+    LinkNode *nodes = links->nodes;
+    nodes[nodes[column].right].left = nodes[column].left;
+    nodes[nodes[column].left].right = nodes[column].right;
+    for(int i = nodes[column].down; i != column; i = nodes[i].down){
+        for(int j = nodes[i].right; j != i; j = nodes[j].right){
+            nodes[nodes[j].down].up = nodes[j].up;
+            nodes[nodes[j].up].down = nodes[j].down;
+            links->sizes[nodes[j].column]--;
+        }
+    }
+
+}
+
+void uncoverColumn(DancingLinks *links, int column){
+
+    LinkNode *nodes = links->nodes;
+    for(int i = nodes[column].up; i != column; i = nodes[i].up){
+        for(int j = nodes[i].left; j != i; j = nodes[j].left){
+            links->sizes[nodes[j].column]++;
+            nodes[nodes[j].down].up = j;
+            nodes[nodes[j].up].down = j;
+        }
+    }
+    nodes[nodes[column].right].left = column;
+    nodes[nodes[column].left].right = column;
+
+}
+
+void searchLocal(Solver *solver){
+
+    int size = solver->size;
+    unsigned int all = (1u << size) - 1;
+    uint64_t seed = LOCAL_SEED;
+    int grid[N][N];
+    int count[N][N] = {{0}};
+    int cells[N*N];
+    memcpy(grid, solver->grid, sizeof(grid));
+
+    for(int i = 0; i < size; i++){
+        unsigned int missing = all & ~solver->rowUsed[i];
+        for(int j = 0; j < size; j++){
+            if(grid[i][j] == 0){
+                unsigned int pick = missing;
+                for(int skip = randomNext(&seed) % __builtin_popcount(missing); skip > 0; skip--){
+                    pick &= pick - 1;
+                }
+                grid[i][j] = __builtin_ctz(pick) + 1;
+                missing &= ~(pick & -pick);
+            }
+        }
+    }
+    int conflicts = 0;
+    for(int i = 0; i < size; i++){
+        for(int j = 0; j < size; j++){
+            conflicts += count[j][grid[i][j] - 1]++ > 0;
+        }
+    }
+
+    while(conflicts > 0){
+        if(countNode(solver)){
+            return;
+        }
+        int n = 0;
+        for(int i = 0; i < size; i++){
+            for(int j = 0; j < size; j++){
+                if(solver->grid[i][j] == 0 && count[j][grid[i][j] - 1] > 1){
+                    cells[n++] = i*size + j;
+                }
+            }
+        }
+        int pick = cells[randomNext(&seed) % n];
+        int i = pick / size, j = pick % size;
+        int a = grid[i][j] - 1;
+        int noisy = randomNext(&seed) % 100 < LOCAL_NOISE;
+        int best = -1, bestDelta = INT_MAX, ties = 0;
+        for(int k = 0; k < size; k++){
+            if(k == j || solver->grid[i][k] != 0){
+                continue;
+            }
+            int b = grid[i][k] - 1;
+            int delta = noisy ? 0 : (count[j][b] >= 1) - (count[j][a] >= 2) + (count[k][a] >= 1) - (count[k][b] >= 2);
+            if(delta < bestDelta){
+                best = k;
+                bestDelta = delta;
+                ties = 1;
+            }
+            else if(delta == bestDelta && randomNext(&seed) % ++ties == 0){
+                best = k;
+            }
+        }
+        if(best < 0){
+            continue;
+        }
+        int b = grid[i][best] - 1;
+        conflicts += (count[j][b] >= 1) - (count[j][a] >= 2) + (count[best][a] >= 1) - (count[best][b] >= 2);
+        count[j][a]--;
+        count[j][b]++;
+        count[best][b]--;
+        count[best][a]++;
+        grid[i][j] = b + 1;
+        grid[i][best] = a + 1;
+    }
+
+    memcpy(solver->solution, grid, sizeof(grid));
+    solver->solutions = 1;
+
+}
+
+void searchRestarts(Solver *solver){
+
+    xoshiroSeed(solver->rng, solver->seed);
+    for(long run = 1; ; run++){
+        solver->failLimit = solver->backtracks + RESTART_UNIT * lubyTerm(run);
+        searchRandomized(solver);
+        if(solver->stopped != STOP_RESTART){
+            break;
+        }
+        solver->stopped = STOP_NONE;
+        solver->restarts++;
+    }
+    solver->failLimit = 0;
+
+}
+
+void searchRandomized(Solver *solver){
+
+    if(countNode(solver)){
+        return;
+    }
+    int row, col;
+    unsigned int cand;
+    int count = pickCellRandom(solver, &row, &col, &cand);
+    if(row < 0){
+        if(solver->solutions == 0){
+            memcpy(solver->solution, solver->grid, sizeof(solver->grid));
+        }
+        solver->solutions++;
+        return;
+    }
+
+    if(count == 1){
+        solver->forcedChoices++;
+    }
+    if(++solver->depth > solver->peakDepth){
+        solver->peakDepth = solver->depth;
+    }
+    while(cand != 0 && solver->solutions < solver->limit && !solver->stopped){
+        unsigned int bit = cand;
+        for(int skip = xoshiroNext(solver->rng) % __builtin_popcount(cand); skip > 0; skip--){
+            bit &= bit - 1;
+        }
+        bit &= -bit;
+        cand &= ~bit;
+        long found = solver->solutions;
+        placeValue(solver, row, col, bit);
+        searchRandomized(solver);
+        solver->rowUsed[row] &= ~bit;
+        solver->colUsed[col] &= ~bit;
+        if(!solver->stopped && solver->solutions == found && ++solver->backtracks >= solver->failLimit && solver->failLimit > 0){
+            solver->stopped = STOP_RESTART;
+        }
+    }
+    solver->depth--;
+    solver->grid[row][col] = 0;
+
+}
+
+int pickCellRandom(Solver *solver, int *row, int *col, unsigned int *cand){
+
+    int size = solver->size;
+    unsigned int all = (1u << size) - 1;
+    int bestCount = size + 1;
+    int ties = 0;
+    *row = -1;
+    *col = -1;
+    *cand = 0;
+
+    for(int i = 0; i < size && bestCount > 1; i++){
+        for(int j = 0; j < size; j++){
+            if(solver->grid[i][j] != 0){
+                continue;
+            }
+            unsigned int c = all & ~(solver->rowUsed[i] | solver->colUsed[j]);
+            int count = __builtin_popcount(c);
+            if(count < bestCount || (count == bestCount && xoshiroNext(solver->rng) % ++ties == 0)){
+                ties = count < bestCount ? 1 : ties;
+                *row = i;
+                *col = j;
+                *cand = c;
+                bestCount = count;
+                if(count <= 1){
+                    break;
+                }
+            }
+        }
+    }
+
+    return bestCount;
+
+}
+
+long lubyTerm(long i){
+
+    while(1){
+        int k = 1;
+        while((1L << k) - 1 < i){
+            k++;
+        }
+        if((1L << k) - 1 == i){
+            return 1L << (k - 1);
+        }
+        i -= (1L << (k - 1)) - 1;
+    }
+
+}
+
+void runPortfolio(int sudoku[][N], int size, SolveBudget *budget, uint64_t seed){
+
+    static PortfolioEntry entries[] = {
+        {.name = "backtrack", .run = searchLatinSquare},
+        {.name = "propagate", .run = searchPropagating},
+        {.name = "dlx", .run = solveLinks},
+        {.name = "local", .run = searchLocal},
+        {.name = "restarts", .run = searchRestarts},
+    };
+    int backends = sizeof(entries) / sizeof(entries[0]);
+    CancelToken token = {STOP_NONE};
+    for(int k = 0; k < backends; k++){
+        Solver *solver = &entries[k].solver;
+        if(!initSolver(solver, sudoku, size)){
+            printf("Error: the square breaks the Latin square rules!\n");
+            return;
+        }
+        solver->limit = 1;
+        solver->seed = seed;
+        applyBudget(solver, budget);
+        solver->token = &token;
+        entries[k].won = 0;
+    }
+
+    pthread_t ids[sizeof(entries) / sizeof(entries[0])];
+    int started[sizeof(entries) / sizeof(entries[0])];
+    atomic_fetch_add_explicit(&metrics.solves, 1, memory_order_relaxed);
+    for(int k = 0; k < backends; k++){
+        started[k] = pthread_create(&ids[k], NULL, portfolioWorker, &entries[k]) == 0;
+    }
+    for(int k = 0; k < backends; k++){
+        if(started[k]){
+            pthread_join(ids[k], NULL);
+        }
+    }
+
+    char *reasons[] = {"", "cancelled", "timeout", "nodelimit", "lost", "disconnected"};
+    PortfolioEntry *winner = NULL;
+    long restarts = 0;
+    printf("%-10s %-12s %14s %10s\n", "backend", "result", "nodes", "seconds");
+    for(int k = 0; k < backends; k++){
+        Solver *solver = &entries[k].solver;
+        char *result = solver->solutions > 0 ? "solved" : solver->stopped ? reasons[solver->stopped] : "unsolvable";
+        printf("%-10s %-12s %14ld %10.3f%s\n", entries[k].name, started[k] ? result : "not started",
+            solver->nodes, entries[k].seconds, entries[k].won ? "  winner" : "");
+        if(entries[k].won){
+            winner = &entries[k];
+        }
+        if(strcmp(entries[k].name, "restarts") == 0){
+            restarts = solver->restarts;
+        }
+    }
+    printf("Seed %llu, %ld restarts\n", (unsigned long long)seed, restarts);
+    if(winner == NULL){
+        printf("No backend finished within the budget\n");
+    }
+    else if(winner->solver.solutions == 0){
+        printf("The square has no completion\n");
+    }
+    else{
+        int result[N][N];
+        for(int i = 0; i < size; i++){
+            for(int j = 0; j < size; j++){
+                result[i][j] = sudoku[i][j] < 0 ? sudoku[i][j] : winner->solver.solution[i][j];
+            }
+        }
+        displayLatinSquare(result, size);
+    }
+
+}
+
+void *portfolioWorker(void *arg){
+
+    PortfolioEntry *entry = arg;
+    traceThread(entry->name);
+    double start = traceBegin();
+    entry->seconds = wallSeconds();
+    entry->run(&entry->solver);
+    entry->seconds = wallSeconds() - entry->seconds;
+    traceEnd("search", start);
+    if(!entry->solver.stopped){
+        entry->won = cancelToken(entry->solver.token, STOP_FOUND);
+    }
+    mergeSolverStats(&entry->solver);
+
+    return NULL;
+
+}
+
+void searchParallel(Solver *solver, int threads){
+
+    threads = threads < MAX_THREADS ? threads : MAX_THREADS;
+    int target = threads * TASKS_PER_THREAD;
+    int capacity = target * solver->size;
+    ParallelSearch *search = threads > 1 ? calloc(1, sizeof(ParallelSearch)) : NULL;
+    Solver *workers = threads > 1 ? calloc(threads, sizeof(Solver)) : NULL;
+    int (*tasks)[N][N] = threads > 1 ? malloc(capacity * sizeof(*tasks)) : NULL;
+    int (*next)[N][N] = threads > 1 ? malloc(capacity * sizeof(*next)) : NULL;
+    if(search == NULL || workers == NULL || tasks == NULL || next == NULL){
+        free(search);
+        free(workers);
+        free(tasks);
+        free(next);
+        searchLatinSquare(solver);
+        return;
+    }
+
+    memcpy(tasks[0], solver->grid, sizeof(solver->grid));
+    memcpy(solver->deepest, solver->grid, sizeof(solver->grid));
+    int count = 1, depth = 0;
+    Solver *probe = &workers[0];
+    probe->size = solver->size;
+    while(count > 0 && count < target && solver->solutions < solver->limit){
+        int expanded = 0;
+        for(int t = 0; t < count; t++){
+            loadTask(probe, tasks[t]);
+            solver->nodes++;
+            int row, col;
+            unsigned int cand;
+            if(pickCell(probe, &row, &col, &cand) == 1){
+                solver->forcedChoices++;
+            }
+            if(row < 0){
+                if(solver->solutions == 0){
+                    memcpy(solver->solution, probe->grid, sizeof(probe->grid));
+                }
+                solver->solutions += solver->solutions < solver->limit;
+                continue;
+            }
+            for(; cand != 0; cand &= cand - 1){
+                memcpy(next[expanded], probe->grid, sizeof(probe->grid));
+                next[expanded++][row][col] = __builtin_ctz(cand) + 1;
+            }
+        }
+        int (*swap)[N][N] = tasks;
+        tasks = next;
+        next = swap;
+        count = expanded;
+        if(count > 0){
+            solver->peakDepth = ++depth;
+            memcpy(solver->deepest, tasks[0], sizeof(solver->grid));
+        }
+    }
+
+    if(count > 0 && solver->solutions < solver->limit){
+        CancelToken *token = solver->token;
+        if(token == NULL){
+            solver->token = &search->token;
+        }
+        search->root = solver;
+        search->workers = workers;
+        pthread_mutex_init(&search->hookLock, NULL);
+        search->perf = perfGroup != NULL && perfGroup->active;
+        search->tasks = tasks;
+        search->taskCount = count;
+        atomic_init(&search->nodes, solver->nodes);
+        for(int k = 0; k < threads; k++){
+            memset(&workers[k], 0, sizeof(Solver));
+            workers[k].size = solver->size;
+            workers[k].limit = solver->limit;
+            workers[k].deadline = solver->deadline;
+            workers[k].token = solver->token;
+            workers[k].progress = parallelCheck;
+            workers[k].owner = search;
+        }
+
+        growPool(threads - 1);
+        pthread_mutex_lock(&workerPool.lock);
+        search->threads = threads;
+        search->claimed = 1;
+        ParallelSearch **tail = &workerPool.queue;
+        while(*tail != NULL){
+            tail = &(*tail)->next;
+        }
+        *tail = search;
+        pthread_cond_broadcast(&workerPool.ready);
+        pthread_mutex_unlock(&workerPool.lock);
+
+        parallelWorker(&workers[0]);
+
+        // Take back the helpers no pool thread claimed, then wait for the others
+        pthread_mutex_lock(&workerPool.lock);
+        for(ParallelSearch **link = &workerPool.queue; *link != NULL; link = &(*link)->next){
+            if(*link == search){
+                *link = search->next;
+                break;
+            }
+        }
+        while(search->running > 0){
+            pthread_cond_wait(&workerPool.done, &workerPool.lock);
+        }
+        pthread_mutex_unlock(&workerPool.lock);
+        pthread_mutex_destroy(&search->hookLock);
+
+        long solutions = 0;
+        int deepest = -1;
+        for(int k = 0; k < threads; k++){
+            Solver *worker = &workers[k];
+            if(worker->solutions > 0 && solutions == 0){
+                memcpy(solver->solution, worker->solution, sizeof(worker->solution));
+            }
+            solutions += worker->solutions;
+            solver->backtracks += worker->backtracks;
+            solver->forcedChoices += worker->forcedChoices;
+            if(worker->nodes > 0 && (deepest < 0 || worker->peakDepth > workers[deepest].peakDepth)){
+                deepest = k;
+            }
+        }
+        if(deepest >= 0){
+            solver->peakDepth = depth + workers[deepest].peakDepth;
+            memcpy(solver->deepest, workers[deepest].deepest, sizeof(solver->deepest));
+        }
+        solver->nodes = atomic_load(&search->nodes);
+        solver->solutions = solutions < solver->limit ? solutions : solver->limit;
+        int reason = atomic_load(&solver->token->reason);
+        if(solver->solutions < solver->limit && reason != STOP_NONE){
+            solver->stopped = reason;
+        }
+        solver->token = token;
+    }
+
+    free(search);
+    free(workers);
+    free(tasks);
+    free(next);
+
+}
+
+void growPool(int threads){
+
+    pthread_mutex_lock(&workerPool.lock);
+    while(workerPool.threads < threads){
+        pthread_t thread;
+        if(pthread_create(&thread, NULL, poolThread, NULL) != 0){
+            break;
+        }
+        pthread_detach(thread);
+        workerPool.threads++;
+    }
+    pthread_mutex_unlock(&workerPool.lock);
+
+}
+
+void *poolThread(void *arg){
+
+    (void)arg;
+    traceThread("search worker");
+    pthread_mutex_lock(&workerPool.lock);
+    while(1){
+        while(workerPool.queue == NULL){
+            pthread_cond_wait(&workerPool.ready, &workerPool.lock);
+        }
+        ParallelSearch *search = workerPool.queue;
+        Solver *worker = &search->workers[search->claimed++];
+        search->running++;
+        if(search->claimed == search->threads){
+            workerPool.queue = search->next;
+        }
+        pthread_mutex_unlock(&workerPool.lock);
+
+        // Only searches under the solve phase run in parallel
+        PerfSample sample;
+        if(search->perf){
+            perfBegin(&sample);
+        }
+        parallelWorker(worker);
+        if(search->perf){
+            perfMerge(PERF_SOLVE, &sample);
+        }
+
+        pthread_mutex_lock(&workerPool.lock);
+        search->running--;
+        pthread_cond_broadcast(&workerPool.done);
+    }
+
+    return NULL;
+
+}
+
+void *parallelWorker(void *arg){
+
+    Solver *worker = arg;
+    ParallelSearch *search = worker->owner;
+    double start = traceBegin();
+    while(!worker->stopped && worker->solutions < worker->limit
+        && atomic_load_explicit(&worker->token->reason, memory_order_relaxed) == STOP_NONE){
+        int task = atomic_fetch_add_explicit(&search->nextTask, 1, memory_order_relaxed);
+        if(task >= search->taskCount){
+            break;
+        }
+        double taskStart = traceBegin();
+        loadTask(worker, search->tasks[task]);
+        searchLatinSquare(worker);
+        traceEnd("task", taskStart);
+    }
+    traceEnd("worker", start);
+
+    parallelCheck(worker);
+    if(worker->solutions >= worker->limit){
+        cancelToken(worker->token, STOP_FOUND);
+    }
+    else if(worker->stopped){
+        cancelToken(worker->token, worker->stopped);
+    }
+
+    return NULL;
+
+}
+
+void parallelCheck(Solver *worker){
+
+    ParallelSearch *search = worker->owner;
+    Solver *root = search->root;
+    long *published = search->published[worker - search->workers];
+    long nodes = worker->nodes - published[0];
+    long solutions = worker->solutions - published[1];
+    published[0] = worker->nodes;
+    published[1] = worker->solutions;
+    nodes += atomic_fetch_add_explicit(&search->nodes, nodes, memory_order_relaxed);
+    solutions += atomic_fetch_add_explicit(&search->solutions, solutions, memory_order_relaxed);
+
+    if(solutions >= root->limit){
+        cancelToken(worker->token, STOP_FOUND);
+    }
+    if(root->nodeLimit > 0 && nodes > root->nodeLimit){
+        cancelToken(worker->token, STOP_NODES);
+    }
+    if(root->progress != NULL && pthread_mutex_trylock(&search->hookLock) == 0){
+        root->nodes = nodes;
+        root->solutions = solutions;
+        root->progress(root);
+        if(root->stopped){
+            cancelToken(worker->token, root->stopped);
+        }
+        pthread_mutex_unlock(&search->hookLock);
+    }
+
+}
+
+void loadTask(Solver *worker, int task[][N]){
+
+    memcpy(worker->grid, task, sizeof(worker->grid));
+    for(int i = 0; i < worker->size; i++){
+        worker->rowUsed[i] = 0;
+        worker->colUsed[i] = 0;
+    }
+    for(int i = 0; i < worker->size; i++){
+        for(int j = 0; j < worker->size; j++){
+            if(worker->grid[i][j] != 0){
+                worker->rowUsed[i] |= 1u << (worker->grid[i][j] - 1);
+                worker->colUsed[j] |= 1u << (worker->grid[i][j] - 1);
+            }
+        }
+    }
+
+}
+
+int cancelToken(CancelToken *token, int reason){
+
+    int none = STOP_NONE;
+    return atomic_compare_exchange_strong(&token->reason, &none, reason);
+
+}
+
+void watchHangup(Solver *solver){
+
+    SolveBudget *budget = solver->owner;
+    double now = wallSeconds();
+    if(now - budget->checked < HANGUP_SECONDS){
+        return;
+    }
+    budget->checked = now;
+    struct pollfd pfd = {.fd = budget->hangup, .events = POLLRDHUP};
+    if(poll(&pfd, 1, 0) != 1){
+        return;
+    }
+    int gone = (pfd.revents & (POLLHUP | POLLERR)) != 0;
+    if(!gone && (pfd.revents & POLLRDHUP) && budget->probe){
+        char probe[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        budget->probe = 0;
+        gone = send(budget->hangup, probe, sizeof(probe) - 1, MSG_NOSIGNAL | MSG_DONTWAIT) != sizeof(probe) - 1;
+    }
+    if(gone){
+        solver->stopped = STOP_DISCONNECTED;
+        if(solver->token != NULL){
+            cancelToken(solver->token, STOP_DISCONNECTED);
+        }
+    }
+
+}
+
+int pickCell(Solver *solver, int *row, int *col, unsigned int *cand){
+
+    int size = solver->size;
+    unsigned int all = (1u << size) - 1;
+    int bestCount = size + 1;
+    *row = -1;
+    *col = -1;
+    *cand = 0;
+
+    for(int i = 0; i < size && bestCount > 1; i++){
+        for(int j = 0; j < size; j++){
+            if(solver->grid[i][j] != 0){
+                continue;
+            }
+            unsigned int c = all & ~(solver->rowUsed[i] | solver->colUsed[j]);
+            int count = __builtin_popcount(c);
+            if(count < bestCount){
+                *row = i;
+                *col = j;
+                *cand = c;
+                bestCount = count;
+                if(count <= 1){
+                    break;
+                }
+            }
+        }
+    }
+
+    return bestCount;
+
+}
+
+double estimateTreeSize(int sudoku[][N], int size, int probes, double *solutions, double *rate){
+
+    Solver *root = malloc(sizeof(Solver));
+    Solver *probe = malloc(sizeof(Solver));
+    *solutions = 0;
+    *rate = 0;
+    if(root == NULL || probe == NULL || !initSolver(root, sudoku, size)){
+        free(root);
+        free(probe);
+        return 0;
+    }
+
+    uint64_t seed = ESTIMATE_SEED;
+    double nodes = 0;
+    long visited = 0;
+    double start = wallSeconds();
+    for(int k = 0; k < probes; k++){
+        memcpy(probe, root, sizeof(Solver));
+        double weight = 1;
+        while(1){
+            nodes += weight;
+            visited++;
+            int row, col;
+            unsigned int cand;
+            int count = pickCell(probe, &row, &col, &cand);
+            if(row < 0){
+                *solutions += weight;
+                break;
+            }
+            if(count == 0){
+                break;
+            }
+            for(int skip = randomNext(&seed) % count; skip > 0; skip--){
+                cand &= cand - 1;
+            }
+            placeValue(probe, row, col, cand & -cand);
+            weight *= count;
+        }
+    }
+    double elapsed = wallSeconds() - start;
+    *rate = elapsed > 0 ? visited / elapsed : 0;
+    *solutions /= probes;
+    free(root);
+    free(probe);
+
+    return nodes / probes;
+
+}
+
+void countLatinSquare(int sudoku[][N], int size, int estimateOnly, SolveBudget *budget){
+
+    double solutions, rate;
+    double estimate = estimateTreeSize(sudoku, size, ESTIMATE_PROBES, &solutions, &rate);
+    if(estimate == 0){
+        printf("Error: the square breaks the Latin square rules!\n");
+        return;
+    }
+    printf("Estimated search tree: %.3g nodes, %.3g solutions (%d probes)\n", estimate, solutions, ESTIMATE_PROBES);
+    if(rate > 0){
+        printf("Estimated time: %.3g seconds at %.3g nodes/s\n", estimate / rate, rate);
+    }
+    fflush(stdout);
+    if(estimateOnly){
+        return;
+    }
+
+    Solver *solver = malloc(sizeof(Solver));
+    if(solver == NULL){
+        return;
+    }
+    initSolver(solver, sudoku, size);
+    CountProgress progress = {.start = wallSeconds(), .estimate = estimate};
+    progress.last = progress.start;
+    solver->limit = LONG_MAX;
+    applyBudget(solver, budget);
+    solver->progress = countProgress;
+    solver->owner = &progress;
+
+    double start = traceBegin();
+    atomic_fetch_add_explicit(&metrics.solves, 1, memory_order_relaxed);
+    searchParallel(solver, budget != NULL ? budget->threads : 1);
+    traceEnd("search", start);
+    mergeSolverStats(solver);
+
+    double elapsed = wallSeconds() - progress.start;
+    if(progress.last > progress.start){
+        fprintf(stderr, "\n");
+    }
+    if(solver->stopped){
+        printf("Stopped by the %s budget, the count is a lower bound\n", solver->stopped == STOP_TIMEOUT ? "time" : "node");
+    }
+    printf("Solutions: %ld\n", solver->solutions);
+    printf("Search nodes: %ld (estimate was %.3g) in %.3f seconds\n", solver->nodes, estimate, elapsed);
+    free(solver);
+
+}
+
+void countProgress(Solver *solver){
+
+    CountProgress *progress = solver->owner;
+    double now = wallSeconds();
+    if(now - progress->last < PROGRESS_SECONDS){
+        return;
+    }
+    progress->last = now;
+
+    double elapsed = now - progress->start;
+    double done = solver->nodes / progress->estimate;
+    if(done >= 1){
+        fprintf(stderr, "\rprogress >100%% of the estimate, %ld nodes, %ld solutions, %.0fs elapsed   ",
+            solver->nodes, solver->solutions, elapsed);
+    }
+    else{
+        fprintf(stderr, "\rprogress %5.1f%%, %ld nodes, %ld solutions, %.0fs elapsed, eta %.0fs   ",
+            100 * done, solver->nodes, solver->solutions, elapsed, elapsed * (1 - done) / done);
+    }
+
+}
+
+void startBackgroundSolve(Game *game){
+
+    pthread_t thread;
+    memcpy(game->base, game->sudoku, sizeof(game->base));
+    atomic_store(&game->solveState, SOLVE_RUNNING);
+    if(pthread_create(&thread, NULL, backgroundSolve, game) == 0){
+        pthread_detach(thread);
+    }
+
+}
+
+void *backgroundSolve(void *arg){
+
+    Game *game = arg;
+
+    traceThread("background solve");
+    game->solutions = solveLatinSquare(game->base, game->size, game->solution, 2, NULL, NULL);
+    atomic_store_explicit(&game->solveState, SOLVE_DONE, memory_order_release);
+
+    return NULL;
+
+}
+
+void runServer(char address[], Game *game, char metricsPort[]){
+
+    static Server server;
+    server.listener = openListener(address);
+    if(server.listener < 0){
+        printf("error, cannot listen on %s\n", address);
+        return;
+    }
+    if(metricsPort != NULL){
+        pthread_t thread;
+        server.metricsListener = openListener(metricsPort);
+        if(server.metricsListener < 0){
+            printf("error, cannot listen on %s\n", metricsPort);
+            return;
+        }
+        fcntl(server.metricsListener, F_SETFL, fcntl(server.metricsListener, F_GETFL) & ~O_NONBLOCK);
+        if(pthread_create(&thread, NULL, serveMetrics, &server) == 0){
+            pthread_detach(thread);
+        }
+    }
+    server.epfd = epoll_create1(0);
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+    epoll_ctl(server.epfd, EPOLL_CTL_ADD, server.listener, &ev);
+    signal(SIGPIPE, SIG_IGN);
+
+    game->log.fd = -1;
+    game->file = NULL;
+    game->onMove = recordDelta;
+    game->solutions = solveLatinSquare(game->sudoku, game->size, game->solution, 2, NULL, NULL);
+    atomic_store(&game->solveState, SOLVE_DONE);
+    server.game = game;
+
+    struct epoll_event events[SERVER_EVENTS];
+    printf("Serving on %s\n", address);
+    fflush(stdout);
+
+    while(1){
+        int n = epoll_wait(server.epfd, events, SERVER_EVENTS, -1);
+        for(int k = 0; k < n; k++){
+            if(events[k].data.ptr == NULL){
+                acceptSessions(&server);
+            }
+            else{
+                serveSession(&server, events[k].data.ptr, events[k].events);
+            }
+        }
+    }
+
+}
+
+void acceptSessions(Server *server){
+
+    Game *game = server->game;
+    int fd;
+    while((fd = accept4(server->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0){
+        Session *session = slabAlloc(&server->slab, game->size, sizeof(Session) + SESSION_OUT_BYTES(game->size));
+        int id = 0;
+        while(id < server->capacity && server->sessions[id] != NULL){
+            id++;
+        }
+        if(session != NULL && id == server->capacity){
+            int capacity = server->capacity ? 2 * server->capacity : SERVER_EVENTS;
+            Session **sessions = realloc(server->sessions, capacity * sizeof(Session *));
+            if(sessions == NULL){
+                slabFree(&server->slab, game->size, session);
+                session = NULL;
+            }
+            else{
+                memset(sessions + server->capacity, 0, (capacity - server->capacity) * sizeof(Session *));
+                server->sessions = sessions;
+                server->capacity = capacity;
+            }
+        }
+        if(session == NULL){
+            close(fd);
+            continue;
+        }
+
+        memset(session, 0, sizeof(Session));
+        session->fd = fd;
+        session->id = id;
+        atomic_fetch_add_explicit(&metrics.sessions, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&metrics.sessionsTotal, 1, memory_order_relaxed);
+        server->sessions[id] = session;
+        memcpy(&session->game, game, sizeof(Game));
+        session->game.owner = session;
+        session->game.out = session->out;
+        session->game.outCap = SESSION_OUT_BYTES(game->size);
+        gamePrintf(&session->game, "Session %d\n", id);
+        playStart(&session->game);
+
+        struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT, .data.ptr = session};
+        epoll_ctl(server->epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+}
+
+void serveSession(Server *server, Session *session, uint32_t events){
+
+    int failed = session->dropped || (events & (EPOLLERR | EPOLLHUP)) != 0;
+    if(!failed && (events & EPOLLIN)){
+        ssize_t len = read(session->fd, session->in + session->inLen, LINE_LEN - 1 - session->inLen);
+        if(len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR)){
+            failed = 1;
+        }
+        else if(len > 0){
+            session->inLen += len;
+        }
+    }
+    while(!failed){
+        processSession(server, session);
+        failed = flushSession(server, session) < 0;
+        if(session->game.outLen > 0 || session->game.state != PLAY_INPUT
+            || memchr(session->in, '\n', session->inLen) == NULL){
+            break;
+        }
+    }
+    if(failed){
+        closeSession(server, session);
+        return;
+    }
+    updateSession(server, session);
+
+}
+
+void updateSession(Server *server, Session *session){
+
+    int pending = session->game.outLen > session->outSent || session->queueCount > 0;
+    if(session->closing && !pending){
+        closeSession(server, session);
+        return;
+    }
+
+    struct epoll_event ev = {.data.ptr = session};
+    ev.events = (pending || session->dropped ? EPOLLOUT : 0)
+        | (!session->closing && session->inLen < LINE_LEN - 1 ? EPOLLIN : 0);
+    epoll_ctl(server->epfd, EPOLL_CTL_MOD, session->fd, &ev);
+
+}
+
+void closeSession(Server *server, Session *session){
+
+    if(session->watching != NULL){
+        if(session->prevWatcher != NULL){
+            session->prevWatcher->nextWatcher = session->nextWatcher;
+        }
+        else{
+            session->watching->watchers = session->nextWatcher;
+        }
+        if(session->nextWatcher != NULL){
+            session->nextWatcher->prevWatcher = session->prevWatcher;
+        }
+    }
+
+    if(session->watchers != NULL){
+        char end[32];
+        int len = sprintf(end, "E %d\n", session->id);
+        broadcast(server, session, end, len);
+        for(Session *watcher = session->watchers; watcher != NULL; watcher = watcher->nextWatcher){
+            watcher->watching = NULL;
+            watcher->closing = 1;
+        }
+    }
+
+    while(session->queueCount > 0){
+        Broadcast *message = session->queue[session->queueHead];
+        if(--message->refs == 0){
+            slabFree(&server->slab, 0, message);
+        }
+        session->queueHead = (session->queueHead + 1) % SPECTATOR_QUEUE;
+        session->queueCount--;
+    }
+
+    epoll_ctl(server->epfd, EPOLL_CTL_DEL, session->fd, NULL);
+    close(session->fd);
+    server->sessions[session->id] = NULL;
+    slabFree(&server->slab, session->game.size, session);
+    atomic_fetch_sub_explicit(&metrics.sessions, 1, memory_order_relaxed);
+
+}
+
+void *serveMetrics(void *arg){
+
+    Server *server = arg;
+    char in[HTTP_BUFFER];
+    char body[METRICS_BUFFER];
+    char head[256];
+    struct timeval idle = {HTTP_IDLE_SECONDS, 0};
+
+    while(1){
+        int fd = accept4(server->metricsListener, NULL, NULL, SOCK_CLOEXEC);
+        if(fd < 0){
+            continue;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+
+        HttpRequest req;
+        int inLen = 0, reqLen = 0;
+        while(reqLen == 0 && inLen < HTTP_BUFFER){
+            ssize_t len = recv(fd, in + inLen, HTTP_BUFFER - inLen, 0);
+            if(len <= 0){
+                break;
+            }
+            inLen += len;
+            reqLen = parseHttpRequest(in, inLen, &req);
+        }
+        if(reqLen > 0){
+            int found = strcmp(req.method, "GET") == 0 && strcmp(req.path, "/metrics") == 0;
+            int bodyLen = found ? writeMetrics(body, sizeof(body), &server->slab) : sprintf(body, "not found\n");
+            int headLen = snprintf(head, sizeof(head),
+                "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\nConnection: close\r\n\r\n",
+                found ? "200 OK" : "404 Not Found", bodyLen);
+            if(send(fd, head, headLen, MSG_NOSIGNAL) == headLen){
+                send(fd, body, bodyLen, MSG_NOSIGNAL);
+            }
+        }
+        close(fd);
+    }
+
+    return NULL;
+
+}
+
+int writeMetrics(char out[], int cap, SlabAllocator *slab){
+
+    char *names[COMMAND_TYPES] = {"insert", "clear", "hint", "query", "save"};
+    int len = snprintf(out, cap,
+        "# HELP latinsquare_sessions Sessions connected to the game server.\n"
+        "# TYPE latinsquare_sessions gauge\n"
+        "latinsquare_sessions %ld\n"
+        "# HELP latinsquare_sessions_total Sessions accepted since startup.\n"
+        "# TYPE latinsquare_sessions_total counter\n"
+        "latinsquare_sessions_total %ld\n"
+        "# HELP latinsquare_moves_total Moves applied, rate() gives moves per second.\n"
+        "# TYPE latinsquare_moves_total counter\n"
+        "latinsquare_moves_total %ld\n"
+        "# HELP latinsquare_solves_total Solver searches run.\n"
+        "# TYPE latinsquare_solves_total counter\n"
+        "latinsquare_solves_total %ld\n",
+        atomic_load_explicit(&metrics.sessions, memory_order_relaxed),
+        atomic_load_explicit(&metrics.sessionsTotal, memory_order_relaxed),
+        atomic_load_explicit(&metrics.moves, memory_order_relaxed),
+        atomic_load_explicit(&metrics.solves, memory_order_relaxed));
+
+    len += snprintf(out + len, cap - len,
+        "# HELP latinsquare_command_seconds Time from receiving a command to its response.\n"
+        "# TYPE latinsquare_command_seconds histogram\n");
+    for(int type = 0; type < COMMAND_TYPES && len < cap; type++){
+        LatencyHistogram *histogram = &latencies[type];
+        long cumulative = 0;
+        int bucket = 0;
+        for(int power = 10; power <= 30 && len < cap; power++){
+            for(int limit = latencyBucket(1UL << power); bucket < limit; bucket++){
+                cumulative += atomic_load_explicit(&histogram->buckets[bucket], memory_order_relaxed);
+            }
+            len += snprintf(out + len, cap - len, "latinsquare_command_seconds_bucket{command=\"%s\",le=\"%g\"} %ld\n",
+                names[type], (1L << power) / 1e9, cumulative);
+        }
+        for(; bucket < LATENCY_BUCKETS; bucket++){
+            cumulative += atomic_load_explicit(&histogram->buckets[bucket], memory_order_relaxed);
+        }
+        if(len < cap){
+            len += snprintf(out + len, cap - len,
+                "latinsquare_command_seconds_bucket{command=\"%s\",le=\"+Inf\"} %ld\n"
+                "latinsquare_command_seconds_sum{command=\"%s\"} %.9f\n"
+                "latinsquare_command_seconds_count{command=\"%s\"} %ld\n",
+                names[type], cumulative, names[type],
+                atomic_load_explicit(&histogram->sum, memory_order_relaxed) / 1e9, names[type], cumulative);
+        }
+    }
+
+    char *pools[3] = {"latinsquare_pool_objects_in_use", "latinsquare_pool_slabs", "latinsquare_pool_bytes"};
+    char *helps[3] = {"Objects handed out by the slab allocator", "Slabs allocated by the slab allocator",
+        "Bytes allocated by the slab allocator"};
+    for(int metric = 0; metric < 3 && len < cap; metric++){
+        len += snprintf(out + len, cap - len, "# HELP %s %s.\n# TYPE %s gauge\n", pools[metric], helps[metric], pools[metric]);
+        for(int class = 0; class <= N && len < cap; class++){
+            SlabClass *slabClass = &slab->classes[class];
+            atomic_long *value = metric == 0 ? &slabClass->inUse : metric == 1 ? &slabClass->slabs : &slabClass->bytes;
+            if(atomic_load_explicit(&slabClass->slabs, memory_order_relaxed) == 0){
+                continue;
+            }
+            len += snprintf(out + len, cap - len, "%s{class=\"%s\",order=\"%d\"} %ld\n", pools[metric],
+                class == 0 ? "broadcast" : "session", class, atomic_load_explicit(value, memory_order_relaxed));
+        }
+    }
+
+    return len < cap ? len : cap - 1;
+
+}
+
+int openListener(char address[]){
+
+    int fd;
+    if(strncmp(address, "unix:", 5) == 0){
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        strncpy(addr.sun_path, address + 5, sizeof(addr.sun_path) - 1);
+        unlink(addr.sun_path);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0){
+            return -1;
+        }
+    }
+    else{
+        struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(atoi(address))};
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        int one = 1;
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(fd < 0){
+            return -1;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0){
+            close(fd);
+            return -1;
+        }
+    }
+    if(listen(fd, SERVER_BACKLOG) != 0){
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+
+}
+
+void *slabAlloc(SlabAllocator *slab, int class, size_t size){
+
+    SlabClass *slabClass = &slab->classes[class];
+    if(slabClass->objectSize == 0){
+        slabClass->objectSize = (size + 15) & ~(size_t)15;
+    }
+
+    if(slabClass->free == NULL){
+        size_t bytes = slabClass->objectSize > SLAB_BYTES ? slabClass->objectSize : SLAB_BYTES;
+        char *chunk = malloc(bytes);
+        if(chunk == NULL){
+            return NULL;
+        }
+        for(size_t off = 0; off + slabClass->objectSize <= bytes; off += slabClass->objectSize){
+            *(void **)(chunk + off) = slabClass->free;
+            slabClass->free = chunk + off;
+        }
+        atomic_fetch_add_explicit(&slabClass->slabs, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&slabClass->bytes, bytes, memory_order_relaxed);
+    }
+
+    void *object = slabClass->free;
+    slabClass->free = *(void **)object;
+    atomic_fetch_add_explicit(&slabClass->inUse, 1, memory_order_relaxed);
+
+    return object;
+
+}
+
+void slabFree(SlabAllocator *slab, int class, void *object){
+
+    SlabClass *slabClass = &slab->classes[class];
+    *(void **)object = slabClass->free;
+    slabClass->free = object;
+    atomic_fetch_sub_explicit(&slabClass->inUse, 1, memory_order_relaxed);
+
+}
+
+void processSession(Server *server, Session *session){
+
+    Game *game = &session->game;
+    char *start = session->in;
+    char *end;
+
+    while(game->state == PLAY_INPUT && game->outCap - game->outLen >= SESSION_REPLY_BYTES(game->size)
+        && (end = memchr(start, '\n', session->in + session->inLen - start)) != NULL){
+        *end = '\0';
+        if(end > start && end[-1] == '\r'){
+            end[-1] = '\0';
+        }
+        if(session->watching != NULL){
+            // Spectators only listen
+        }
+        else if(strncmp(start, "watch ", 6) == 0){
+            watchSession(server, session, atoi(start + 6));
+        }
+        else{
+            session->deltaLen = sprintf(session->delta, "D %d ", session->id);
+            double begin = traceBegin();
+            playFeed(game, start);
+            traceEnd("command", begin);
+            if(session->delta[session->deltaLen - 1] != ' '){
+                session->delta[session->deltaLen - 1] = '\n';
+                broadcast(server, session, session->delta, session->deltaLen);
+            }
+        }
+        start = end + 1;
+    }
+    if(game->state == PLAY_OVER){
+        session->closing = 1;
+    }
+
+    session->inLen -= start - session->in;
+    memmove(session->in, start, session->inLen);
+    if(session->inLen == LINE_LEN - 1 && memchr(session->in, '\n', session->inLen) == NULL){
+        gamePrintf(game, "Error: wrong format of command!\n>");
+        session->inLen = 0;
+    }
+
+}
+
+int flushSession(Server *server, Session *session){
+
+    Game *game = &session->game;
+    while(session->outSent < game->outLen){
+        ssize_t len = send(session->fd, game->out + session->outSent, game->outLen - session->outSent, MSG_NOSIGNAL);
+        if(len < 0){
+            return errno == EAGAIN || errno == EINTR ? 0 : -1;
+        }
+        session->outSent += len;
+    }
+    game->outLen = 0;
+    session->outSent = 0;
+
+    while(session->queueCount > 0){
+        Broadcast *message = session->queue[session->queueHead];
+        ssize_t len = send(session->fd, message->data + session->queueSent, message->len - session->queueSent, MSG_NOSIGNAL);
+        if(len < 0){
+            return errno == EAGAIN || errno == EINTR ? 0 : -1;
+        }
+        session->queueSent += len;
+        if(session->queueSent < message->len){
+            continue;
+        }
+        if(--message->refs == 0){
+            slabFree(&server->slab, 0, message);
+        }
+        session->queueHead = (session->queueHead + 1) % SPECTATOR_QUEUE;
+        session->queueCount--;
+        session->queueSent = 0;
+    }
+
+    return 0;
+
+}
+
+void watchSession(Server *server, Session *session, int id){
+
+    Game *game = &session->game;
+    Session *target = id >= 0 && id < server->capacity ? server->sessions[id] : NULL;
+    if(target == NULL || target == session || target->watching != NULL){
+        gamePrintf(game, "Error: no game %d to watch!\n>", id);
+        return;
+    }
+
+    session->watching = target;
+    session->prevWatcher = NULL;
+    session->nextWatcher = target->watchers;
+    if(target->watchers != NULL){
+        target->watchers->prevWatcher = session;
+    }
+    target->watchers = session;
+
+    gamePrintf(game, "S %d %d", id, target->game.size);
+    for(int i = 0; i < target->game.size; i++){
+        for(int j = 0; j < target->game.size; j++){
+            gamePrintf(game, " %d", target->game.sudoku[i][j]);
+        }
+    }
+    gamePrintf(game, "\n");
+
+}
+
+void recordDelta(void *owner, int i, int j, int val){
+
+    Session *session = owner;
+    if(session->deltaLen < DELTA_BYTES - 16){
+        session->deltaLen += sprintf(session->delta + session->deltaLen, "%d,%d=%d;", i, j, val);
+    }
+
+}
+
+void broadcast(Server *server, Session *session, char data[], int len){
+
+    if(session->watchers == NULL){
+        return;
+    }
+    Broadcast *message = slabAlloc(&server->slab, 0, sizeof(Broadcast));
+    if(message == NULL){
+        return;
+    }
+    memcpy(message->data, data, len);
+    message->len = len;
+    message->refs = 0;
+
+    for(Session *watcher = session->watchers; watcher != NULL; watcher = watcher->nextWatcher){
+        if(watcher->queueCount == SPECTATOR_QUEUE){
+            watcher->dropped = 1;
+        }
+        else{
+            watcher->queue[(watcher->queueHead + watcher->queueCount++) % SPECTATOR_QUEUE] = message;
+            message->refs++;
+        }
+        updateSession(server, watcher);
+    }
+    if(message->refs == 0){
+        slabFree(&server->slab, 0, message);
+    }
+
+}
+
+
+void runHttpServer(char port[]){
+
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(atoi(port))};
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int one = 1;
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0
+        || listen(listener, SERVER_BACKLOG) != 0){
+        printf("error, cannot listen on port %s\n", port);
+        return;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    static ConnQueue queue = {.lock = PTHREAD_MUTEX_INITIALIZER, .ready = PTHREAD_COND_INITIALIZER};
+    for(int k = 0; k < HTTP_WORKERS; k++){
+        pthread_t thread;
+        pthread_create(&thread, NULL, httpWorker, &queue);
+        pthread_detach(thread);
+    }
+    printf("Serving HTTP API on port %s\n", port);
+    fflush(stdout);
+
+    while(1){
+        int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if(fd < 0){
+            continue;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        pthread_mutex_lock(&queue.lock);
+        if(queue.count == HTTP_QUEUE){
+            pthread_mutex_unlock(&queue.lock);
+            close(fd);
+            continue;
+        }
+        queue.fds[(queue.head + queue.count++) % HTTP_QUEUE] = fd;
+        pthread_cond_signal(&queue.ready);
+        pthread_mutex_unlock(&queue.lock);
+    }
+
+}
+
+void *httpWorker(void *arg){
+
+    ConnQueue *queue = arg;
+    traceThread("http worker");
+    while(1){
+        pthread_mutex_lock(&queue->lock);
+        while(queue->count == 0){
+            pthread_cond_wait(&queue->ready, &queue->lock);
+        }
+        int fd = queue->fds[queue->head];
+        queue->head = (queue->head + 1) % HTTP_QUEUE;
+        queue->count--;
+        pthread_mutex_unlock(&queue->lock);
+
+        double start = traceBegin();
+        serveHttpConnection(fd);
+        close(fd);
+        traceEnd("connection", start);
+    }
+
+    return NULL;
+
+}
+
+void serveHttpConnection(int fd){
+
+    char in[HTTP_BUFFER];
+    char body[HTTP_BUFFER];
+    char out[HTTP_BUFFER + 256];
+    int inLen = 0;
+    struct timeval idle = {HTTP_IDLE_SECONDS, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+
+    while(1){
+        HttpRequest req;
+        int reqLen = parseHttpRequest(in, inLen, &req);
+        if(reqLen == 0){
+            if(inLen == HTTP_BUFFER){
+                reqLen = -1;
+            }
+            else{
+                ssize_t len = recv(fd, in + inLen, HTTP_BUFFER - inLen, 0);
+                if(len <= 0){
+                    return;
+                }
+                inLen += len;
+                continue;
+            }
+        }
+
+        int status = 400;
+        int bodyLen;
+        if(reqLen < 0){
+            bodyLen = snprintf(body, sizeof(body), "{\"error\":\"malformed request\"}");
+            req.keepAlive = 0;
+        }
+        else{
+            double start = traceBegin();
+            req.fd = fd;
+            bodyLen = handleApiRequest(&req, body, sizeof(body), &status);
+            traceEnd("request", start);
+        }
+        int outLen = snprintf(out, sizeof(out),
+            "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\nContent-Length: %d\r\nConnection: %s\r\n\r\n%.*s",
+            status, status == 200 ? "OK" : status == 404 ? "Not Found" : "Bad Request",
+            bodyLen, req.keepAlive ? "keep-alive" : "close", bodyLen, body);
+        if(send(fd, out, outLen, MSG_NOSIGNAL) != outLen || !req.keepAlive){
+            return;
+        }
+
+        inLen -= reqLen;
+        memmove(in, in + reqLen, inLen);
+    }
+
+}
+
+int parseHttpRequest(char buf[], int len, HttpRequest *req){
+
+    char *end = memmem(buf, len, "\r\n\r\n", 4);
+    if(end == NULL){
+        return 0;
+    }
+    int headLen = end + 4 - buf;
+
+    char version[16];
+    *end = '\0';
+    if(sscanf(buf, "%7s %63s %15s", req->method, req->path, version) != 3
+        || strncmp(version, "HTTP/1.", 7) != 0){
+        *end = '\r';
+        return -1;
+    }
+    req->keepAlive = strcmp(version, "HTTP/1.1") == 0;
+    req->http11 = req->keepAlive;
+    req->bodyLen = 0;
+
+    for(char *line = strstr(buf, "\r\n"); line != NULL && line < end; line = strstr(line + 2, "\r\n")){
+        char *header = line + 2;
+        if(strncasecmp(header, "Content-Length:", 15) == 0){
+            req->bodyLen = atoi(header + 15);
+        }
+        else if(strncasecmp(header, "Connection:", 11) == 0){
+            char *value = header + 11;
+            while(*value == ' '){
+                value++;
+            }
+            if(strncasecmp(value, "close", 5) == 0){
+                req->keepAlive = 0;
+            }
+            else if(strncasecmp(value, "keep-alive", 10) == 0){
+                req->keepAlive = 1;
+            }
+        }
+    }
+    *end = '\r';
+
+    if(req->bodyLen < 0 || headLen + req->bodyLen > HTTP_BUFFER){
+        return -1;
+    }
+    if(headLen + req->bodyLen > len){
+        return 0;
+    }
+    req->body = buf + headLen;
+
+    return headLen + req->bodyLen;
+
+}
+
+int handleApiRequest(HttpRequest *req, char out[], int cap, int *status){
+
+    int sudoku[N][N] = {0};
+    int size = 0;
+    *status = 200;
+
+    if(strcmp(req->method, "POST") != 0 || (strcmp(req->path, "/generate") != 0 && strcmp(req->path, "/solve") != 0
+        && strcmp(req->path, "/validate") != 0 && strcmp(req->path, "/count") != 0 && strcmp(req->path, "/rate") != 0)){
+        *status = 404;
+        return snprintf(out, cap, "{\"error\":\"unknown endpoint\"}");
+    }
+
+    char *reasons[] = {"", "cancelled", "timeout", "nodelimit", "found", "disconnected"};
+    SolveBudget budget = {
+        .seconds = jsonLong(req->body, req->bodyLen, "ms", 0) / 1000.0,
+        .nodes = jsonLong(req->body, req->bodyLen, "nodes", 0),
+        .threads = solveThreads,
+        .hangup = req->fd,
+        .probe = req->http11
+    };
+    int stopped;
+    if(strcmp(req->path, "/generate") == 0){
+        size = jsonLong(req->body, req->bodyLen, "size", 0);
+        if(size < 1 || size > N){
+            *status = 400;
+            return snprintf(out, cap, "{\"error\":\"size must be in [1..%d]\"}", N);
+        }
+        stopped = generateLatinSquare(sudoku, size, jsonLong(req->body, req->bodyLen, "seed", (long)time(NULL)), &budget);
+        int len = snprintf(out, cap, "{\"size\":%d,\"board\":", size);
+        len += writeBoardJson(out + len, cap - len, sudoku, size);
+        if(stopped != STOP_NONE){
+            len += snprintf(out + len, cap - len, ",\"stopped\":\"%s\"", reasons[stopped]);
+        }
+        return len + snprintf(out + len, cap - len, "}");
+    }
+
+    if(!parseBoardJson(req->body, req->bodyLen, sudoku, &size)){
+        *status = 400;
+        return snprintf(out, cap, "{\"error\":\"malformed board\"}");
+    }
+
+    if(strcmp(req->path, "/solve") == 0){
+        int solution[N][N];
+        int len;
+        if(solveLatinSquare(sudoku, size, solution, 1, &budget, &stopped) > 0){
+            len = snprintf(out, cap, "{\"status\":\"solved\",\"board\":");
+        }
+        else if(stopped != STOP_NONE){
+            len = snprintf(out, cap, "{\"status\":\"stopped\",\"reason\":\"%s\",\"partial\":", reasons[stopped]);
+        }
+        else{
+            return snprintf(out, cap, "{\"status\":\"unsolvable\"}");
+        }
+        len += writeBoardJson(out + len, cap - len, solution, size);
+        return len + snprintf(out + len, cap - len, "}");
+    }
+    if(strcmp(req->path, "/validate") == 0){
+        Solver solver;
+        int valid = initSolver(&solver, sudoku, size);
+        return snprintf(out, cap, "{\"valid\":%s,\"complete\":%s}", valid ? "true" : "false",
+            valid && checkGame(sudoku, size) ? "true" : "false");
+    }
+    if(strcmp(req->path, "/count") == 0){
+        int solution[N][N];
+        long limit = jsonLong(req->body, req->bodyLen, "limit", COUNT_LIMIT);
+        long count = solveLatinSquare(sudoku, size, solution, limit, &budget, &stopped);
+        if(stopped != STOP_NONE){
+            return snprintf(out, cap, "{\"count\":%ld,\"complete\":false,\"stopped\":\"%s\"}", count, reasons[stopped]);
+        }
+        return snprintf(out, cap, "{\"count\":%ld,\"complete\":%s}", count, count < limit ? "true" : "false");
+    }
+
+    long nodes = 0;
+    char *rating = rateLatinSquare(sudoku, size, &nodes, &budget);
+    return snprintf(out, cap, "{\"rating\":\"%s\",\"nodes\":%ld}", rating, nodes);
+
+}
+
+int parseBoardJson(char json[], int len, int sudoku[][N], int *size){
+
+    char *board = memmem(json, len, "\"board\"", 7);
+    if(board == NULL){
+        return 0;
+    }
+    char *p = board + 7;
+    char *end = json + len;
+    while(p < end && *p != '['){
+        p++;
+    }
+
+    int values[N*N];
+    int count = 0, depth = 0;
+    for(; p < end; p++){
+        if(*p == '['){
+            depth++;
+        }
+        else if(*p == ']'){
+            if(--depth == 0){
+                break;
+            }
+        }
+        else if(*p == '-' || (*p >= '0' && *p <= '9')){
+            if(count == N*N){
+                return 0;
+            }
+            values[count++] = (int)strtol(p, &p, 10);
+            p--;
+        }
+        else if(*p != ',' && *p != ' ' && *p != '\n' && *p != '\r' && *p != '\t'){
+            return 0;
+        }
+    }
+
+    int n = jsonLong(json, len, "size", 0);
+    if(n == 0){
+        while(n*n < count){
+            n++;
+        }
+    }
+    if(depth != 0 || n < 1 || n > N || n*n != count){
+        return 0;
+    }
+    for(int k = 0; k < count; k++){
+        if(abs(values[k]) > n){
+            return 0;
+        }
+        sudoku[k / n][k % n] = -abs(values[k]);
+    }
+    *size = n;
+
+    return 1;
+
+}
+
+long jsonLong(char json[], int len, char key[], long def){
+
+    char quoted[32];
+    int keyLen = snprintf(quoted, sizeof(quoted), "\"%s\"", key);
+    char *p = memmem(json, len, quoted, keyLen);
+    if(p == NULL){
+        return def;
+    }
+    p += keyLen;
+    while(p < json + len && (*p == ' ' || *p == ':')){
+        p++;
+    }
+    if(p == json + len){
+        return def;
+    }
+
+    return strtol(p, NULL, 10);
+
+}
+
+int writeBoardJson(char out[], int cap, int sudoku[][N], int size){
+
+    int len = snprintf(out, cap, "[");
+    for(int i = 0; i < size && len < cap; i++){
+        len += snprintf(out + len, cap - len, i == 0 ? "[" : ",[");
+        for(int j = 0; j < size && len < cap; j++){
+            len += snprintf(out + len, cap - len, j == 0 ? "%d" : ",%d", abs(sudoku[i][j]));
+        }
+        len += snprintf(out + len, cap - len, "]");
+    }
+    len += snprintf(out + len, cap - len, "]");
+
+    return len < cap ? len : cap - 1;
+
+}
+
+int generateLatinSquare(int sudoku[][N], int size, uint64_t seed, SolveBudget *budget){
+
+    int rows[N], cols[N], symbols[N];
+    for(int k = 0; k < size; k++){
+        rows[k] = cols[k] = symbols[k] = k;
+    }
+    for(int k = size - 1; k > 0; k--){
+        int r = randomNext(&seed) % (k + 1), c = randomNext(&seed) % (k + 1), v = randomNext(&seed) % (k + 1);
+        int t = rows[k]; rows[k] = rows[r]; rows[r] = t;
+        t = cols[k]; cols[k] = cols[c]; cols[c] = t;
+        t = symbols[k]; symbols[k] = symbols[v]; symbols[v] = t;
+    }
+    for(int i = 0; i < size; i++){
+        for(int j = 0; j < size; j++){
+            sudoku[rows[i]][cols[j]] = -(symbols[(i + j) % size] + 1);
+        }
+    }
+
+    int cells[N*N];
+    for(int k = 0; k < size*size; k++){
+        cells[k] = k;
+    }
+    for(int k = size*size - 1; k > 0; k--){
+        int r = randomNext(&seed) % (k + 1);
+        int t = cells[k]; cells[k] = cells[r]; cells[r] = t;
+    }
+    Solver *solver = malloc(sizeof(Solver));
+    if(solver == NULL){
+        return STOP_NONE;
+    }
+    // Every uniqueness check starts from a fresh solver, so keep what the
+    // budget sets up and hand it to each one
+    initSolver(solver, sudoku, size);
+    applyBudget(solver, budget);
+    double deadline = solver->deadline;
+    long nodes = solver->nodeLimit;
+    CancelToken *token = solver->token;
+    void (*progress)(Solver *solver) = solver->progress;
+    void *owner = solver->owner;
+    long used = 0;
+    int stopped = STOP_NONE;
+    double start = traceBegin();
+    for(int k = 0; k < size*size && stopped == STOP_NONE; k++){
+        if(deadline > 0 && wallSeconds() > deadline){
+            stopped = STOP_TIMEOUT;
+            break;
+        }
+        if(nodes > 0 && used >= nodes){
+            stopped = STOP_NODES;
+            break;
+        }
+        int i = cells[k] / size, j = cells[k] % size;
+        int val = sudoku[i][j];
+        sudoku[i][j] = 0;
+        initSolver(solver, sudoku, size);
+        solver->limit = 2;
+        solver->deadline = deadline;
+        solver->nodeLimit = nodes > 0 ? nodes - used : 0;
+        solver->token = token;
+        solver->progress = progress;
+        solver->owner = owner;
+        // Most checks end before countNode() first polls the token and the hook
+        if(progress != NULL){
+            progress(solver);
+        }
+        if(token != NULL && solver->stopped == STOP_NONE){
+            solver->stopped = atomic_load(&token->reason);
+        }
+        if(solver->stopped == STOP_NONE){
+            atomic_fetch_add_explicit(&metrics.solves, 1, memory_order_relaxed);
+            searchLatinSquare(solver);
+            mergeSolverStats(solver);
+            used += solver->nodes;
+        }
+        stopped = solver->stopped;
+        if(solver->solutions != 1 || stopped != STOP_NONE){
+            sudoku[i][j] = val;
+        }
+    }
+    traceEnd("generate", start);
+    free(solver);
+
+    return stopped;
+
+}
+
+char *rateLatinSquare(int sudoku[][N], int size, long *nodes, SolveBudget *budget){
+
+    Solver *solver = malloc(sizeof(Solver));
+    *nodes = 0;
+    if(solver == NULL || !initSolver(solver, sudoku, size)){
+        free(solver);
+        return "invalid";
+    }
+    PerfSample sample;
+    double start = traceBegin();
+    perfBegin(&sample);
+    int outcome = propagateSolver(solver, 0);
+    perfEnd(PERF_VERIFY, &sample, solver->propagations);
+    traceEnd("propagate", start);
+    if(outcome == PROPAGATE_SOLVED || outcome == PROPAGATE_DEAD){
+        mergeSolverStats(solver);
+        free(solver);
+        return outcome == PROPAGATE_SOLVED ? "easy" : "invalid";
+    }
+
+    solver->limit = 1;
+    applyBudget(solver, budget);
+    start = traceBegin();
+    perfBegin(&sample);
+    atomic_fetch_add_explicit(&metrics.solves, 1, memory_order_relaxed);
+    searchParallel(solver, budget != NULL ? budget->threads : 1);
+    perfEnd(PERF_SOLVE, &sample, solver->nodes);
+    traceEnd("search", start);
+    mergeSolverStats(solver);
+    *nodes = solver->nodes;
+    long solutions = solver->solutions;
+    int stopped = solver->stopped;
+    free(solver);
+    if(solutions == 0){
+        return stopped ? "unrated" : "invalid";
+    }
+
+    return *nodes <= 10 * size ? "medium" : "hard";
+
+}
+
+uint64_t randomNext(uint64_t *state){
+
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+
+}
+
+uint64_t xoshiroNext(uint64_t state[4]){
+
+    uint64_t x = state[1] * 5;
+    uint64_t result = ((x << 7) | (x >> 57)) * 9;
+    uint64_t t = state[1] << 17;
+    state[2] ^= state[0];
+    state[3] ^= state[1];
+    state[1] ^= state[2];
+    state[0] ^= state[3];
+    state[2] ^= t;
+    state[3] = (state[3] << 45) | (state[3] >> 19);
+    return result;
+
+}
+
+void xoshiroSeed(uint64_t state[4], uint64_t seed){
+
+    for(int k = 0; k < 4; k++){
+        state[k] = randomNext(&seed);
+    }
+
+}
+
+void runEngine(){
+
+    static Engine engine;
+    char line[HTTP_BUFFER];
+    engine.game.log.fd = -1;
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    while(fgets(line, sizeof(line), stdin) != NULL && engineCommand(&engine, line)){}
+
+    cancelToken(&engine.cancel, STOP_CANCELLED);
+    if(engine.started){
+        pthread_join(engine.thread, NULL);
+    }
+
+}
+
+int engineCommand(Engine *engine, char line[]){
+
+    Game *game = &engine->game;
+    char command[16] = "";
+    int offset = 0;
+    sscanf(line, "%15s %n", command, &offset);
+    char *args = line + offset;
+
+    if(strcmp(command, "quit") == 0){
+        return 0;
+    }
+    if(strcmp(command, "isready") == 0){
+        printf("readyok\n");
+    }
+    else if(strcmp(command, "stop") == 0){
+        cancelToken(&engine->cancel, STOP_CANCELLED);
+    }
+    else if(atomic_load(&engine->searching) && strcmp(command, "show") != 0 && strcmp(command, "hint") != 0){
+        printf("error busy\n");
+    }
+    else if(strcmp(command, "board") == 0){
+        int size = 0, len = 0, ok = 1;
+        int sudoku[N][N] = {0};
+        if(sscanf(args, "%d%n", &size, &len) != 1 || size < 1 || size > N){
+            ok = 0;
+        }
+        for(int k = 0; ok && k < size*size; k++){
+            args += len;
+            if(sscanf(args, "%d%n", &sudoku[k / size][k % size], &len) != 1 || abs(sudoku[k / size][k % size]) > size){
+                ok = 0;
+            }
+            sudoku[k / size][k % size] = -abs(sudoku[k / size][k % size]);
+        }
+        Solver solver;
+        if(!ok || !initSolver(&solver, sudoku, size)){
+            printf("error board\n");
+        }
+        else{
+            memcpy(game->sudoku, sudoku, sizeof(sudoku));
+            game->size = size;
+            initCandidates(game);
+            printf("ok\n");
+        }
+    }
+    else if(game->size == 0){
+        printf("error noboard\n");
+    }
+    else if(strcmp(command, "move") == 0){
+        int i = 0, j = 0, val = 0;
+        int err = MOVE_RANGE;
+        if(sscanf(args, "%d,%d=%d", &i, &j, &val) == 3 && (i != 0 || j != 0)){
+            err = checkMove(game->sudoku, game->size, val, i, j);
+        }
+        if(err == MOVE_OK){
+            game->sudoku[i-1][j-1] = val;
+            updateCandidates(game, i-1, j-1);
+            printf("ok\n");
+        }
+        else{
+            char *reasons[] = {"", "range", "occupied", "clear", "value"};
+            printf("error %s\n", reasons[err]);
+        }
+    }
+    else if(strcmp(command, "hint") == 0){
+        int row = 0, col = 0, val = 0;
+        int kind = hintCell(game, &row, &col, &val);
+        if(kind == HINT_NONE || kind == HINT_DEAD){
+            printf("hint %s\n", kind == HINT_NONE ? "none" : "dead");
+        }
+        else{
+            printf("hint %d %d %d%s\n", row+1, col+1, val, kind == HINT_GUESS ? " guess" : "");
+        }
+    }
+    else if(strcmp(command, "show") == 0){
+        char out[HTTP_BUFFER];
+        int len = sprintf(out, "board %d", game->size);
+        for(int i = 0; i < game->size; i++){
+            for(int j = 0; j < game->size; j++){
+                len += sprintf(out + len, " %d", game->sudoku[i][j]);
+            }
+        }
+        printf("%s\n", out);
+    }
+    else if(strcmp(command, "solve") == 0){
+        double ms = 0;
+        engine->budget.nodes = 0;
+        sscanf(args, "%lf %ld", &ms, &engine->budget.nodes);
+        engine->budget.seconds = ms / 1000;
+        engine->budget.threads = solveThreads;
+        engine->budget.token = &engine->cancel;
+        atomic_store(&engine->cancel.reason, STOP_NONE);
+        if(engine->started){
+            pthread_join(engine->thread, NULL);
+            engine->started = 0;
+        }
+        atomic_store(&engine->searching, 1);
+        if(pthread_create(&engine->thread, NULL, engineSolve, engine) != 0){
+            atomic_store(&engine->searching, 0);
+            printf("error thread\n");
+        }
+        else{
+            engine->started = 1;
+        }
+    }
+    else{
+        printf("error unknown\n");
+    }
+
+    if(engine->started && !atomic_load(&engine->searching)){
+        pthread_join(engine->thread, NULL);
+        engine->started = 0;
+    }
+
+    return 1;
+
+}
+
+void *engineSolve(void *arg){
+
+    Engine *engine = arg;
+    Solver *solver = malloc(sizeof(Solver));
+    if(solver == NULL){
+        printf("error memory\n");
+        atomic_store(&engine->searching, 0);
+        return NULL;
+    }
+    initSolver(solver, engine->game.sudoku, engine->game.size);
+    solver->limit = 1;
+    applyBudget(solver, &engine->budget);
+
+    traceThread("engine search");
+    PerfSample sample;
+    double start = traceBegin();
+    perfBegin(&sample);
+    atomic_fetch_add_explicit(&metrics.solves, 1, memory_order_relaxed);
+    searchParallel(solver, engine->budget.threads);
+    perfEnd(PERF_SOLVE, &sample, solver->nodes);
+    traceEnd("search", start);
+    mergeSolverStats(solver);
+
+    char out[HTTP_BUFFER];
+    int len = 0;
+    if(solver->solutions > 0){
+        len = sprintf(out, "solution");
+        for(int i = 0; i < solver->size; i++){
+            for(int j = 0; j < solver->size; j++){
+                len += sprintf(out + len, " %d", solver->solution[i][j]);
+            }
+        }
+    }
+    else if(solver->stopped == STOP_NONE){
+        len = sprintf(out, "nosolution");
+    }
+    else{
+        char *reasons[] = {"", "stopped", "timeout", "nodelimit", "found", "disconnected"};
+        len = sprintf(out, "%s partial", reasons[solver->stopped]);
+        for(int i = 0; i < solver->size; i++){
+            for(int j = 0; j < solver->size; j++){
+                len += sprintf(out + len, " %d", solver->deepest[i][j]);
+            }
+        }
+    }
+    printf("%s nodes %ld\n", out, solver->nodes);
+    free(solver);
+    atomic_store(&engine->searching, 0);
+
+    return NULL;
+
+}
+
+void printCommands(){
+    printf("Enter your command in the following format:\n");
+    printf(">i,j=val: for entering val at position (i,j)\n");
+    printf(">i,j=0 : for clearing cell (i,j)\n");
+    printf(">i,j=val;i,j=val : for applying several moves at once\n");
+    printf(">? i,j : for showing the candidate values of cell (i,j)\n");
+    printf(">hint : for revealing a cell whose value is forced\n");
+    printf(">latency : for showing the latency percentiles of each command type\n");
+    printf(">0,0=0 : for saving and ending the game\n");
+    printf("Notice: i,j,val numbering is from [1..4]\n");
+    printf(">");
+}
+
+int checkInput(int i, int j, int val, int size){
+    if((i<0 || i>size)||(j<0 || j>size)||(val<0 || val>size)){
+        return 0;
+    }
+    return 1;
+}
+
+uint32_t hashLatinSquare(int sudoku[][N], int size){
+
+    uint32_t hash = 2166136261u;
+    for(int i = 0; i < size; i++){
+        for(int j = 0; j < size; j++){
+            hash ^= (uint32_t)(sudoku[i][j] & 0xff);
+            hash *= 16777619u;
+        }
+    }
+    return hash;
+
+}
+
+void makeLogHeader(unsigned char header[], int sudoku[][N], int size){
+
+    uint32_t hash = hashLatinSquare(sudoku, size);
+    header[0] = 'L';
+    header[1] = 'S';
+    header[2] = 'Q';
+    header[3] = (unsigned char)size;
+    for(int k = 0; k < 4; k++){
+        header[4+k] = (hash >> (8*k)) & 0xff;
+    }
+
+}
+
+long openMoveLog(MoveLog *log, char file[], int sudoku[][N], int size){
+
+    char filename[104];
+    snprintf(filename, sizeof(filename), "%s.log", file);
+
+    log->pending = 0;
+    log->moves = 0;
+    log->fd = open(filename, O_RDWR | O_CREAT, 0644);
+    if(log->fd < 0){
+        printf("Warning: cannot open move log, progress is only saved on exit\n");
+        return 0;
+    }
+
+    unsigned char header[LOG_HEADER_BYTES];
+    makeLogHeader(header, sudoku, size);
+    long len = lseek(log->fd, 0, SEEK_END);
+    unsigned char *data = malloc(len > LOG_HEADER_BYTES ? len : LOG_HEADER_BYTES);
+    long end = LOG_HEADER_BYTES;
+    int snapshotMissing = 0;
+
+    if(data != NULL && len >= LOG_HEADER_BYTES && pread(log->fd, data, len, 0) == len
+        && memcmp(data, header, LOG_HEADER_BYTES) == 0){
+        while(1){
+            if(log->moves > 0 && log->moves % LOG_SNAPSHOT_INTERVAL == 0 && end < logMoveOffset(log->moves, size)){
+                if(end + LOG_SNAPSHOT_BYTES(size) > len || !validLogSnapshot(data + end, size)){
+                    snapshotMissing = 1;
+                    break;
+                }
+                end += LOG_SNAPSHOT_BYTES(size);
+            }
+            unsigned char *rec = data + end;
+            if(end + LOG_MOVE_BYTES > len || (rec[0] ^ rec[1] ^ rec[2] ^ 0x5a) != rec[3]
+                || checkMove(sudoku, size, rec[2], rec[0], rec[1]) != MOVE_OK){
+                break;
+            }
+            sudoku[rec[0]-1][rec[1]-1] = rec[2];
+            log->moves++;
+            end += LOG_MOVE_BYTES;
+        }
     }
-    readLatinSquare(argv[1], sudoku, &size);
-    if(size == 0){
-        return;
+    else if(pwrite(log->fd, header, LOG_HEADER_BYTES, 0) != LOG_HEADER_BYTES){
+        free(data);
+        close(log->fd);
+        log->fd = -1;
+        return 0;
+    }
+    free(data);
+
+    if(ftruncate(log->fd, end) != 0 || lseek(log->fd, end, SEEK_SET) != end){
+        close(log->fd);
+        log->fd = -1;
+        return 0;
+    }
+    if(snapshotMissing){
+        unsigned char snap[LOG_SNAPSHOT_BYTES(N)];
+        makeLogSnapshot(snap, sudoku, size);
+        if(write(log->fd, snap, LOG_SNAPSHOT_BYTES(size)) != LOG_SNAPSHOT_BYTES(size)){
+            close(log->fd);
+            log->fd = -1;
+            return 0;
+        }
     }
-    play(sudoku, size, argv[1]);
+    fsync(log->fd);
+
+    return log->moves;
+
 }
 
-void readLatinSquare(char file[], int sudoku[][N], int *n){
+void appendMove(MoveLog *log, int sudoku[][N], int size, int i, int j, int val){
 
-    FILE *fp;
-    fp = fopen(file, "r");
-    if(fp == NULL){
-        printf("error, cannot open file...");
+    if(log->fd < 0){
+        return;
     }
 
-    fscanf(fp, "%d", n);
-    if(*n>N){
-        printf("wrong n...");
+    unsigned char rec[LOG_MOVE_BYTES + LOG_SNAPSHOT_BYTES(N)] = {i, j, val, i ^ j ^ val ^ 0x5a};
+    int bytes = LOG_MOVE_BYTES;
+    if((log->moves + 1) % LOG_SNAPSHOT_INTERVAL == 0){
+        makeLogSnapshot(rec + LOG_MOVE_BYTES, sudoku, size);
+        bytes += LOG_SNAPSHOT_BYTES(size);
+    }
+    if(write(log->fd, rec, bytes) != bytes){
+        printf("Warning: cannot write to move log\n");
         return;
     }
+    log->moves++;
 
-    for(int i = 0; i < *n; i++){
-        for(int j = 0; j < *n; j++){
-        fscanf(fp, "%d", &sudoku[i][j]);
-        if(abs(sudoku[i][j])>*n){
-            printf("File contains invalid values!\n");
-            *n = 0;
-            return;
-        }
+    if(++log->pending >= LOG_SYNC_BATCH){
+        fdatasync(log->fd);
+        log->pending = 0;
+    }
+
+}
+
+long logMoveOffset(long move, int size){
+    return LOG_HEADER_BYTES + move * LOG_MOVE_BYTES + (move / LOG_SNAPSHOT_INTERVAL) * LOG_SNAPSHOT_BYTES(size);
+}
+
+void makeLogSnapshot(unsigned char rec[], int sudoku[][N], int size){
+
+    unsigned int sum = 0;
+    for(int i = 0; i < size; i++){
+        for(int j = 0; j < size; j++){
+            rec[4 + i*size + j] = (unsigned char)sudoku[i][j];
+            sum += rec[4 + i*size + j];
         }
     }
+    rec[0] = 0xff;
+    rec[1] = (unsigned char)size;
+    rec[2] = sum & 0xff;
+    rec[3] = (sum >> 8) & 0xff;
 
-    if(!feof(fp)){
-        printf("File contains more data than expected!\n");
-        *n = 0;
+}
+
+int validLogSnapshot(unsigned char rec[], int size){
+
+    unsigned int sum = 0;
+    for(int k = 0; k < size*size; k++){
+        sum += rec[4 + k];
+    }
+    return rec[0] == 0xff && rec[1] == size && rec[2] == (sum & 0xff) && rec[3] == ((sum >> 8) & 0xff);
+
+}
+
+void closeMoveLog(MoveLog *log, char file[], int discard){
+
+    if(log->fd < 0){
         return;
     }
 
-    fclose(fp);
+    if(discard){
+        char filename[104];
+        snprintf(filename, sizeof(filename), "%s.log", file);
+        unlink(filename);
+    }
+    else{
+        fdatasync(log->fd);
+    }
+    close(log->fd);
+    log->fd = -1;
 
 }
 
-void displayLatinSquare(int sudoku[][N], int size){
+int replayMoveLog(char logfile[], int sudoku[][N], int size, long seek){
+
+    long len = 0;
+    unsigned char *data = loadFile(logfile, &len);
+    if(data == NULL){
+        printf("error, cannot read file %s\n", logfile);
+        return 1;
+    }
+
+    unsigned char header[LOG_HEADER_BYTES];
+    makeLogHeader(header, sudoku, size);
+    if(len < LOG_HEADER_BYTES || memcmp(data, header, LOG_HEADER_BYTES) != 0){
+        printf("Error: move log does not belong to this square!\n");
+        free(data);
+        return 1;
+    }
+
+    double start = wallSeconds();
+    long move = 0, applied = 0, rejected = 0;
+    if(seek >= LOG_SNAPSHOT_INTERVAL){
+        long snap = seek / LOG_SNAPSHOT_INTERVAL * LOG_SNAPSHOT_INTERVAL;
+        long pos = logMoveOffset(snap, size) - LOG_SNAPSHOT_BYTES(size);
+        if(pos + LOG_SNAPSHOT_BYTES(size) <= len && validLogSnapshot(data + pos, size)){
+            for(int i = 0; i < size; i++){
+                for(int j = 0; j < size; j++){
+                    sudoku[i][j] = (signed char)data[pos + 4 + i*size + j];
+                }
+            }
+            move = snap;
+        }
+    }
 
-    int col = 0, row = 0;
-    for(int i = 0; i <= (2*size); i++){
-       for(int j = 0; j <= (size*6); j++){
-        if(j%6==0 && i%2==0){
-            printf("+");
+    for(; seek < 0 || move < seek; move++){
+        long pos = logMoveOffset(move, size);
+        if(pos + LOG_MOVE_BYTES > len){
+            break;
         }
-        else if(j%6!=0 && i%2==0){
-            printf("-");
+        if(move > 0 && move % LOG_SNAPSHOT_INTERVAL == 0){
+            unsigned char snap[LOG_SNAPSHOT_BYTES(N)];
+            makeLogSnapshot(snap, sudoku, size);
+            if(memcmp(snap, data + pos - LOG_SNAPSHOT_BYTES(size), LOG_SNAPSHOT_BYTES(size)) != 0){
+                printf("Snapshot before move %ld does not match the replayed board\n", move + 1);
+            }
         }
-        else if(i%2!=0 && j%6==0){
-            printf("|");
+        unsigned char *rec = data + pos;
+        int err = MOVE_RANGE;
+        if((rec[0] ^ rec[1] ^ rec[2] ^ 0x5a) == rec[3]){
+            err = checkMove(sudoku, size, rec[2], rec[0], rec[1]);
         }
-        else if(i%2!=0 && sudoku[row][col]<0 && j%2==0){
-            printf("(%d)", abs(sudoku[row][col]));
-            j+=2;
-            col++;
+        if(err != MOVE_OK){
+            printf("Move %ld rejected: %d,%d=%d\n", move + 1, rec[0], rec[1], rec[2]);
+            rejected++;
+            continue;
         }
-        else if(j%3==0 && i%2!=0){
-            printf("%d ", sudoku[row][col]);
-            j++;
-            col++;
+        sudoku[rec[0]-1][rec[1]-1] = rec[2];
+        applied++;
+    }
+    double elapsed = wallSeconds() - start;
+    free(data);
+
+    if(seek > move){
+        printf("Error: move log only holds %ld moves!\n", move);
+        return 1;
+    }
+
+    int filled = 0;
+    for(int i = 0; i < size; i++){
+        for(int j = 0; j < size; j++){
+            if(sudoku[i][j] != 0){
+                filled++;
+            }
         }
-        else{
-            printf(" ");
+    }
+
+    printf("Position: move %ld\n", move);
+    printf("Moves applied: %ld\n", applied);
+    printf("Moves rejected: %ld\n", rejected);
+    printf("Cells filled: %d/%d\n", filled, size*size);
+    printf("Game completed: %s\n", checkGame(sudoku, size) ? "yes" : "no");
+    printf("Time: %.6f s\n", elapsed);
+    printf("Throughput: %.0f moves/s\n", elapsed > 0 ? (applied + rejected) / elapsed : 0.0);
+    for(int i = 0; i < size; i++){
+        for(int j = 0; j < size; j++){
+            printf("%d ", sudoku[i][j]);
         }
-       }
-       if(i%2==0 && i%4!=0){
-        row++;
-       }
-       col=0;
-       printf("\n");
+        printf("\n");
     }
+
+    return rejected != 0;
+
 }
 
-void writeLatinSquare(int sudoku[][N], int size, char file[]){
+unsigned char *loadFile(char file[], long *len){
 
-    char filename[100] = "-out";
-    strcat(filename, file);
+    FILE *fp = fopen(file, "rb");
+    if(fp == NULL){
+        return NULL;
+    }
 
-    FILE *fp;
-    fp = fopen(filename, "w");
+    fseek(fp, 0, SEEK_END);
+    *len = ftell(fp);
+    rewind(fp);
+    unsigned char *data = malloc(*len > 0 ? *len : 1);
+    if(data != NULL && fread(data, 1, *len, fp) != (size_t)*len){
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
 
-    printf("\nSaving to out-lsq1.txt...\n");
+    return data;
 
-    fprintf(fp, "%d\n", size);
-    for(int i=0; i<size; i++){
-        for(int j = 0; j<size; j++){
-            fprintf(fp, "%d ", (sudoku[i][j]));
-        }
-       fprintf(fp, "\n");
+}
+
+double wallSeconds(){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+
+}
+
+void mergeSolverStats(Solver *solver){
+
+    if(statsFormat == STATS_OFF){
+        return;
     }
+    pthread_mutex_lock(&statsLock);
+    statsTotal.solves++;
+    statsTotal.nodes += solver->nodes;
+    statsTotal.backtracks += solver->backtracks;
+    statsTotal.propagations += solver->propagations;
+    statsTotal.nakedSingles += solver->nakedSingles;
+    statsTotal.hiddenSingles += solver->hiddenSingles;
+    statsTotal.forcedChoices += solver->forcedChoices;
+    if(solver->peakDepth > statsTotal.peakDepth){
+        statsTotal.peakDepth = solver->peakDepth;
+    }
+    pthread_mutex_unlock(&statsLock);
 
-    fclose(fp);
+}
 
-    printf("Done\n");
+void printSolverStats(){
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+        + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    double wall = wallSeconds() - statsStart;
+
+    pthread_mutex_lock(&statsLock);
+    SolverStats total = statsTotal;
+    pthread_mutex_unlock(&statsLock);
+
+    if(statsFormat == STATS_JSON){
+        fprintf(stderr, "{\"solves\":%ld,\"nodes\":%ld,\"backtracks\":%ld,\"propagations\":%ld,"
+            "\"naked_singles\":%ld,\"hidden_singles\":%ld,\"forced_choices\":%ld,\"peak_depth\":%d,"
+            "\"wall_seconds\":%.6f,\"cpu_seconds\":%.6f,\"peak_rss_kb\":%ld}\n",
+            total.solves, total.nodes, total.backtracks, total.propagations, total.nakedSingles,
+            total.hiddenSingles, total.forcedChoices, total.peakDepth, wall, cpu, usage.ru_maxrss);
+        return;
+    }
+    fprintf(stderr, "\nSolver statistics\n");
+    fprintf(stderr, "  %-16s %14ld\n", "solves", total.solves);
+    fprintf(stderr, "  %-16s %14ld\n", "nodes", total.nodes);
+    fprintf(stderr, "  %-16s %14ld\n", "backtracks", total.backtracks);
+    fprintf(stderr, "  %-16s %14ld\n", "propagations", total.propagations);
+    fprintf(stderr, "  %-16s %14ld\n", "naked singles", total.nakedSingles);
+    fprintf(stderr, "  %-16s %14ld\n", "hidden singles", total.hiddenSingles);
+    fprintf(stderr, "  %-16s %14ld\n", "forced choices", total.forcedChoices);
+    fprintf(stderr, "  %-16s %14d\n", "peak depth", total.peakDepth);
+    fprintf(stderr, "  %-16s %14.3f\n", "wall seconds", wall);
+    fprintf(stderr, "  %-16s %14.3f\n", "cpu seconds", cpu);
+    fprintf(stderr, "  %-16s %14ld\n", "peak rss kB", usage.ru_maxrss);
 
 }
 
-void play(int sudoku[][N], int size, char file[]){
-    int playing = 1;
-    int i=0, j=0, val=0;
-    int win = 0;
-    while(playing == 1 && win == 0){
+void *statsSignalThread(void *arg){
 
-        displayLatinSquare(sudoku, size);
-        printCommands();
+    (void)arg;
+    sigset_t signals;
+    int received;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigwait(&signals, &received);
+    atomic_store(&exitSignal, received);
+    exit(128 + received);
 
-        while (scanf("%d,%d=%d",&i,&j,&val) != 3) { 
-            while (getchar() != '\n') {}; 
-            printf("Error: wrong format of command!\n");
-            displayLatinSquare(sudoku, size);
-            printCommands();
-            }
-
-        int check = checkInput(i, j, val, size);
-        while(check==0){
-            printf("\nError: i,j or val are outside the allowed range [1..4]!\n");
-            displayLatinSquare(sudoku, size);
-            printCommands();
-            while (scanf("%d,%d=%d",&i,&j,&val) != 3) { 
-                while (getchar() != '\n') {}; 
-                printf("Error: wrong format of command!\n");
-                displayLatinSquare(sudoku, size);
-                printCommands();
-                }
-            check = checkInput(i, j, val, size);
-        }
+    return NULL;
 
-        if(validMove(sudoku, size, val, i, j) == 1){
-            if(i==0 && j==0 && val==0){
-                playing = 0;
-            }
-            else if(sudoku[i-1][j-1] != 0 && val==0){
-                sudoku[i-1][j-1] = 0;
-                printf("\nValue cleared!\n");
+}
+
+void exitBySignal(){
+
+    int received = atomic_load(&exitSignal);
+    if(received == 0){
+        return;
+    }
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, received);
+    signal(received, SIG_DFL);
+    pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+    raise(received);
+
+}
+
+TraceRing *traceThread(const char *name){
+
+    if(traceFile == NULL){
+        return NULL;
+    }
+    if(traceRing == NULL){
+        pthread_mutex_lock(&traceLock);
+        traceRing = traceFree;
+        if(traceRing != NULL){
+            traceFree = traceRing->nextFree;
+        }
+        pthread_mutex_unlock(&traceLock);
+        if(traceRing == NULL){
+            traceRing = calloc(1, sizeof(TraceRing));
+            if(traceRing == NULL){
+                return NULL;
             }
-            else{
-                for(int row = 0; row < size; row++){
-                    for(int col = 0; col < size; col++){
-                        if(i-1 == row && j-1 == col){
-                            sudoku[row][col] = val;
-                        }  
-                    }
-                }
-                printf("\nValue inserted!\n");
+            traceRing->tid = atomic_fetch_add(&traceThreads, 1) + 1;
+            traceRing->name = "thread";
+            traceRing->next = atomic_load(&traceRings);
+            while(!atomic_compare_exchange_weak(&traceRings, &traceRing->next, traceRing)){
+                // next now holds the current list head, try again
             }
         }
+        pthread_setspecific(traceKey, traceRing);
+    }
+    if(name != NULL){
+        traceRing->name = name;
+    }
 
-        win = checkGame(sudoku, size);
+    return traceRing;
 
-    }
+}
+
+void traceRelease(void *arg){
+
+    TraceRing *ring = arg;
+    pthread_mutex_lock(&traceLock);
+    ring->nextFree = traceFree;
+    traceFree = ring;
+    pthread_mutex_unlock(&traceLock);
+
+}
+
+double traceBegin(){
+
+    return traceFile != NULL ? wallSeconds() : 0;
+
+}
+
+void traceEnd(const char *name, double start){
 
-    if(win==1){
-        printf("\nGame completed!!!\n");
-        displayLatinSquare(sudoku, size);
+    if(traceFile == NULL){
+        return;
+    }
+    double end = wallSeconds();
+    TraceRing *ring = traceThread(NULL);
+    if(ring == NULL){
+        return;
     }
+    long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    TraceEvent *event = &ring->events[head % TRACE_EVENTS];
+    event->name = name;
+    event->start = start * 1e6;
+    event->duration = (end - start) * 1e6;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+}
 
-    writeLatinSquare(sudoku, size, file);
+void writeTrace(){
 
-    return;
+    if(traceFile == NULL){
+        return;
+    }
+    FILE *fp = fopen(traceFile, "w");
+    if(fp == NULL){
+        fprintf(stderr, "error, cannot write trace %s\n", traceFile);
+        return;
+    }
+
+    fprintf(fp, "{\"traceEvents\":[");
+    int first = 1;
+    for(TraceRing *ring = atomic_load(&traceRings); ring != NULL; ring = ring->next){
+        fprintf(fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",", ring->tid, ring->name);
+        first = 0;
+        long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        for(long k = head > TRACE_EVENTS ? head - TRACE_EVENTS : 0; k < head; k++){
+            TraceEvent *event = &ring->events[k % TRACE_EVENTS];
+            fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"latinsquare\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                event->name, ring->tid, event->start, event->duration);
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
 
 }
 
-int checkGame(int sudoku[][N], int size){
+PerfGroup *perfOpen(){
 
-    for(int i = 0; i < size; i++){
-        int arr[N] = {0};
-        for(int j = 0; j < size; j++){
-            if(abs(sudoku[i][j]) == 0){
-                return 0;
-            }
-            else if(arr[abs(sudoku[i][j])-1] ==  0){
-                arr[abs(sudoku[i][j])-1] == 1;
-            }
-            else{
-                return 0;
-            }
+    static const unsigned long long configs[PERF_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+    PerfGroup *group = calloc(1, sizeof(PerfGroup));
+    if(group == NULL){
+        return NULL;
+    }
+    group->leader = -1;
+    int members = 0;
+    for(int k = 0; k < PERF_COUNTERS; k++){
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[k];
+        attr.disabled = group->leader < 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        group->fds[k] = syscall(SYS_perf_event_open, &attr, 0, -1, group->leader, 0);
+        if(group->fds[k] < 0){
+            group->slots[k] = -1;
+            int expected = 0;
+            atomic_compare_exchange_strong(&perfError, &expected, errno);
+            continue;
+        }
+        if(group->leader < 0){
+            group->leader = group->fds[k];
         }
+        group->slots[k] = members++;
     }
+    perfGroup = group;
+    pthread_setspecific(perfKey, group);
 
-    for(int j = 0; j < size; j++){
-        int arr[N] = {0};
-        for(int i = 0; i < size; i++){
-            if(abs(sudoku[i][j]) == 0){
-                return 0;
-            }
-            else if(arr[abs(sudoku[i][j])-1] ==  0){
-                arr[abs(sudoku[i][j])-1] == 1;
-            }
-            else{
-                return 0;
-            }
+    return group;
+
+}
+
+void perfClose(void *arg){
+
+    PerfGroup *group = arg;
+    for(int k = 0; k < PERF_COUNTERS; k++){
+        if(group->fds[k] >= 0){
+            close(group->fds[k]);
         }
     }
+    free(group);
 
-    return 1;
+}
+
+void perfBegin(PerfSample *sample){
+
+    sample->group = NULL;
+    if(!perfEnabled){
+        return;
+    }
+    PerfGroup *group = perfGroup != NULL ? perfGroup : perfOpen();
+    if(group == NULL || group->leader < 0){
+        return;
+    }
+    sample->group = group;
+    group->active = 1;
+    ioctl(group->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
 
 }
 
-int validMove(int sudoku[][N], int size, int val, int i, int j){
+int perfStop(PerfSample *sample, long long counts[]){
 
-    if(i==0 && j==0 && val==0){
-        return 1;
+    PerfGroup *group = sample->group;
+    for(int k = 0; k < PERF_COUNTERS; k++){
+        counts[k] = -1;
     }
-    if(sudoku[i-1][j-1] != 0 && val!=0){
-        printf("\nError: cell is already occupied!\n");
+    if(group == NULL){
         return 0;
     }
-    else if(sudoku[i-1][j-1] == 0 && val==0){
-        printf("\nError: illegal to clear cell!\n");
+    ioctl(group->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    group->active = 0;
+    unsigned long long now[PERF_COUNTERS + 3];
+    if(read(group->leader, now, sizeof(now)) < (ssize_t)(3 * sizeof(now[0]))){
         return 0;
     }
-    else if(sudoku[i-1][j-1] < 0 && val==0){
-        printf("\nError: illegal to clear cell!\n");
-        return 0;
+
+    // Times and counts only grow while the group is enabled, so the
+    // difference from the previous read is what this phase counted
+    unsigned long long enabled = now[1] - group->last[1];
+    unsigned long long running = now[2] - group->last[2];
+    for(int k = 0; k < PERF_COUNTERS; k++){
+        int slot = group->slots[k];
+        if(slot < 0){
+            continue;
+        }
+        unsigned long long delta = now[3 + slot] - group->last[3 + slot];
+        counts[k] = running == 0 ? 0 : running < enabled ? (long long)((double)delta * enabled / running) : (long long)delta;
     }
-    
-    if(i!=0 && j!=0 && val==0){
-        return 1;
+    memcpy(group->last, now, sizeof(now));
+
+    return running < enabled;
+
+}
+
+void perfMerge(int phase, PerfSample *sample){
+
+    if(!perfEnabled){
+        return;
     }
+    long long counts[PERF_COUNTERS];
+    int scaled = perfStop(sample, counts);
 
-    for(int col = 0; col < N; col++){
-        if(abs(sudoku[i-1][col]) == val){
-            printf("\nError: Illegal value insertion!\n");
-            return 0;
+    pthread_mutex_lock(&perfLock);
+    PerfTotals *total = &perfTotals[phase];
+    total->scaled |= scaled;
+    for(int k = 0; k < PERF_COUNTERS; k++){
+        if(counts[k] < 0){
+            total->missing[k] = 1;
+        }
+        else{
+            total->counts[k] += counts[k];
         }
     }
+    pthread_mutex_unlock(&perfLock);
 
-    for(int row = 0; row < N; row++){
-        if(abs(sudoku[row][j-1]) == val){
-            printf("\nError: Illegal value insertion!\n");
-            return 0;
-        }
+}
+
+void perfEnd(int phase, PerfSample *sample, long nodes){
+
+    if(!perfEnabled){
+        return;
     }
+    perfMerge(phase, sample);
 
-    return 1;
+    pthread_mutex_lock(&perfLock);
+    perfTotals[phase].runs++;
+    perfTotals[phase].nodes += nodes;
+    pthread_mutex_unlock(&perfLock);
 
 }
 
-void printCommands(){
-    printf("Enter your command in the following format:\n");
-    printf(">i,j=val: for entering val at position (i,j)\n");
-    printf(">i,j=0 : for clearing cell (i,j)\n");
-    printf(">0,0=0 : for saving and ending the game\n");
-    printf("Notice: i,j,val numbering is from [1..4]\n");
-    printf(">");
-}
+void printPerf(){
 
-int checkInput(int i, int j, int val, int size){
-    if((i<0 || i>size)||(j<0 || j>size)||(val<0 || val>size)){
-        return 0;
+    char *names[PERF_COUNTERS] = {"cycles", "instructions", "cache misses", "branch misses"};
+    char *phases[PERF_PHASES] = {"solve", "verify"};
+
+    pthread_mutex_lock(&perfLock);
+    fprintf(stderr, "\nHardware counters\n");
+    int error = atomic_load(&perfError);
+    if(error != 0){
+        fprintf(stderr, "  some counters are unavailable: %s\n", strerror(error));
     }
-    return 1;
-}
\ No newline at end of file
+    if(perfTotals[PERF_SOLVE].scaled || perfTotals[PERF_VERIFY].scaled){
+        fprintf(stderr, "  counters were multiplexed, counts are scaled by time enabled over time running\n");
+    }
+    fprintf(stderr, "  %-22s %16s %16s\n", "", phases[PERF_SOLVE], phases[PERF_VERIFY]);
+    fprintf(stderr, "  %-22s %16ld %16ld\n", "runs", perfTotals[PERF_SOLVE].runs, perfTotals[PERF_VERIFY].runs);
+    fprintf(stderr, "  %-22s %16ld %16ld\n", "nodes", perfTotals[PERF_SOLVE].nodes, perfTotals[PERF_VERIFY].nodes);
+    for(int k = 0; k < PERF_COUNTERS; k++){
+        fprintf(stderr, "  %-22s", names[k]);
+        for(int phase = 0; phase < PERF_PHASES; phase++){
+            if(perfTotals[phase].missing[k]){
+                fprintf(stderr, " %16s", "n/a");
+            }
+            else{
+                fprintf(stderr, " %16lld", perfTotals[phase].counts[k]);
+            }
+        }
+        fprintf(stderr, "\n");
+    }
+
+    char *ratios[3] = {"IPC", "cache misses per node", "branch misses per node"};
+    for(int r = 0; r < 3; r++){
+        fprintf(stderr, "  %-22s", ratios[r]);
+        for(int phase = 0; phase < PERF_PHASES; phase++){
+            PerfTotals *total = &perfTotals[phase];
+            int numerator = r == 0 ? PERF_INSTRUCTIONS : r == 1 ? PERF_CACHE_MISSES : PERF_BRANCH_MISSES;
+            double denominator = r == 0 ? total->counts[PERF_CYCLES] : total->nodes;
+            if(total->missing[numerator] || (r == 0 && total->missing[PERF_CYCLES]) || denominator == 0){
+                fprintf(stderr, " %16s", "n/a");
+            }
+            else{
+                fprintf(stderr, " %16.3f", total->counts[numerator] / denominator);
+            }
+        }
+        fprintf(stderr, "\n");
+    }
+    pthread_mutex_unlock(&perfLock);
+
+}